@@ -0,0 +1,221 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Blit kernel benchmark. Times every kernel usable for opaque, binary alpha
+// and full alpha sprites of typical sizes against SDL blending.
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <SDL.h>
+#include "sdl_blit.h"
+
+#define BENCH_DST_WIDTH 640
+#define BENCH_DST_HEIGHT 480
+// Pixels copied per measurement, divided between blits of one size
+#define BENCH_PIXELS (64 * 1024 * 1024)
+#define BENCH_MAX_KERNELS 4
+
+#define SOURCE_OPAQUE 0
+#define SOURCE_BINARY 1
+#define SOURCE_ALPHA 2
+#define SOURCE_TYPES 3
+
+static const unsigned spriteSizes[][2] = {
+	{16, 16}, {32, 32}, {64, 64}, {128, 96}, {320, 240}, {640, 480}, {0, 0}
+};
+
+static const char *sourceNames[SOURCE_TYPES] = {"opaque", "binary", "alpha"};
+
+static uint32_t amask, rmask, gmask, bmask;
+
+static void initMasks(void) {
+	uint8_t *ptr;
+
+	// Same pixel layout as the game draw buffer
+	ptr = (uint8_t*)&amask;
+	ptr[0] = 0xff;
+	ptr = (uint8_t*)&rmask;
+	ptr[1] = 0xff;
+	ptr = (uint8_t*)&gmask;
+	ptr[2] = 0xff;
+	ptr = (uint8_t*)&bmask;
+	ptr[3] = 0xff;
+}
+
+// Random sprite, binary sprites are about one third transparent
+static SDL_Surface *createSprite(unsigned width, unsigned height,
+	unsigned type) {
+
+	int x, y;
+	uint32_t alpha, *row;
+	SDL_Surface *surf;
+
+	surf = SDL_CreateRGBSurface(0, width, height, 32, rmask, gmask, bmask,
+		amask);
+
+	if (!surf) {
+		throw std::runtime_error(SDL_GetError());
+	}
+
+	for (y = 0; y < surf->h; y++) {
+		row = (uint32_t*)((uint8_t*)surf->pixels + y * surf->pitch);
+
+		for (x = 0; x < surf->w; x++) {
+			switch (type) {
+			case SOURCE_OPAQUE:
+				alpha = amask;
+				break;
+
+			case SOURCE_BINARY:
+				alpha = rand() % 3 ? amask : 0;
+				break;
+
+			default:
+				alpha = rand() & amask;
+				break;
+			}
+
+			row[x] = (rand() & ~amask) | alpha;
+		}
+	}
+
+	SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_BLEND);
+	return surf;
+}
+
+static double elapsed(Uint64 start) {
+	return double(SDL_GetPerformanceCounter() - start) /
+		SDL_GetPerformanceFrequency();
+}
+
+static void printResult(const char *type, unsigned width, unsigned height,
+	const char *kernel, unsigned count, double time) {
+
+	printf("%-7s %4ux%-4u %-5s %10.1f %10.1f\n", type, width, height,
+		kernel, 1e9 * time / count,
+		(double)width * height * count / time / 1e6);
+}
+
+static void benchSDL(SDL_Surface *src, SDL_Surface *dst, unsigned count,
+	const char *type) {
+
+	unsigned i;
+	Uint64 start;
+	SDL_Rect srcrect = {0, 0, src->w, src->h}, dstrect;
+
+	start = SDL_GetPerformanceCounter();
+
+	for (i = 0; i < count; i++) {
+		dstrect = srcrect;
+		dstrect.x = (i * 7) % (dst->w - src->w + 1);
+		dstrect.y = (i * 5) % (dst->h - src->h + 1);
+		SDL_LowerBlit(src, &srcrect, dst, &dstrect);
+	}
+
+	printResult(type, src->w, src->h, "SDL", count, elapsed(start));
+}
+
+static void benchKernel(SDL_Surface *src, SDL_Surface *dst, unsigned count,
+	const char *type, const BlitKernel *kernel) {
+
+	unsigned i, x, y, dstpitch = dst->pitch / sizeof(uint32_t);
+	Uint64 start;
+	uint32_t *pixels = (uint32_t*)dst->pixels;
+
+	start = SDL_GetPerformanceCounter();
+
+	for (i = 0; i < count; i++) {
+		x = (i * 7) % (dst->w - src->w + 1);
+		y = (i * 5) % (dst->h - src->h + 1);
+		kernel->func((const uint32_t*)src->pixels,
+			src->pitch / sizeof(uint32_t),
+			pixels + y * dstpitch + x, dstpitch, src->w, src->h);
+	}
+
+	printResult(type, src->w, src->h, kernel->name, count,
+		elapsed(start));
+}
+
+static void runBenchmark(void) {
+	unsigned i, j, k, count, kernelCount;
+	BlitKernel kernels[BENCH_MAX_KERNELS], opaque;
+	SDL_Surface *dst, *src;
+
+	dst = SDL_CreateRGBSurface(0, BENCH_DST_WIDTH, BENCH_DST_HEIGHT, 32,
+		rmask, gmask, bmask, 0);
+
+	if (!dst) {
+		throw std::runtime_error(SDL_GetError());
+	}
+
+	initBlitFunctions(amask);
+	opaque.name = "copy";
+	opaque.func = opaque_blit;
+	kernelCount = binaryBlitKernels(kernels, BENCH_MAX_KERNELS);
+	printf("%-7s %9s %-5s %10s %10s\n", "source", "size", "blit",
+		"ns/blit", "Mpix/s");
+
+	for (i = 0; spriteSizes[i][0]; i++) {
+		count = BENCH_PIXELS / (spriteSizes[i][0] * spriteSizes[i][1]);
+
+		for (j = 0; j < SOURCE_TYPES; j++) {
+			try {
+				src = createSprite(spriteSizes[i][0],
+					spriteSizes[i][1], j);
+			} catch (...) {
+				SDL_FreeSurface(dst);
+				throw;
+			}
+
+			// Full alpha sprites always go through SDL blending,
+			// binary kernels also handle opaque sprites
+			benchSDL(src, dst, count, sourceNames[j]);
+
+			if (j == SOURCE_OPAQUE) {
+				benchKernel(src, dst, count, sourceNames[j],
+					&opaque);
+			}
+
+			for (k = 0; j != SOURCE_ALPHA && k < kernelCount; k++) {
+				benchKernel(src, dst, count, sourceNames[j],
+					kernels + k);
+			}
+
+			SDL_FreeSurface(src);
+		}
+	}
+
+	SDL_FreeSurface(dst);
+}
+
+int main(int argc, char **argv) {
+	initMasks();
+	srand(1);
+
+	try {
+		runBenchmark();
+	} catch (std::exception &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
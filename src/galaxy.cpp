@@ -183,7 +183,8 @@ StarmapWidget::StarmapWidget(unsigned x, unsigned y, unsigned width,
 	unsigned height, GameState *game, unsigned activePlayer,
 	const char *archive, unsigned starAssets, const uint8_t *palette) :
 	Widget(x, y, width, height), _curStar(-1), _selStar(-1), _startTick(0),
-	_game(game), _activePlayer(activePlayer) {
+	_layerTexture(0), _layerValid(0), _layerX(0), _layerY(0), _game(game),
+	_activePlayer(activePlayer) {
 
 	unsigned i;
 
@@ -199,7 +200,9 @@ StarmapWidget::StarmapWidget(unsigned x, unsigned y, unsigned width,
 }
 
 StarmapWidget::~StarmapWidget(void) {
-
+	if (_layerValid) {
+		freeTexture(_layerTexture);
+	}
 }
 
 unsigned StarmapWidget::starX(unsigned x) const {
@@ -237,6 +240,66 @@ void StarmapWidget::drawStar(int x, int y, const Star *s, unsigned curtick) {
 	img->draw(x - img->width() / 2, y - img->height() / 2, frame);
 }
 
+int StarmapWidget::layerContains(int x, int y, unsigned width,
+	unsigned height) const {
+
+	int lx = _layerX + getX(), ly = _layerY + getY();
+
+	return x >= lx && y >= ly && x + width <= lx + this->width() &&
+		y + height <= ly + this->height();
+}
+
+int StarmapWidget::starInLayer(int x, int y, const Star *s) {
+	const Image *img = getStarSprite(s);
+
+	x += starX(s->x) - img->width() / 2;
+	y += starY(s->y) - img->height() / 2;
+	return layerContains(x, y, img->width(), img->height());
+}
+
+void StarmapWidget::drawLayer(int x, int y) {
+	unsigned i;
+	const Star *ptr;
+
+	for (i = 0, ptr = _game->_starSystems; i < _game->_starSystemCount;
+		i++, ptr++) {
+		if (_curStar != (int)i && starInLayer(x, y, ptr)) {
+			drawStar(x, y, ptr, 0);
+		}
+	}
+}
+
+void StarmapWidget::drawOverlay(int x, int y, unsigned curtick) {
+	unsigned i, sx, sy, color = MAX_PLAYERS;
+	const uint8_t *cdata;
+	const Star *ptr;
+
+	for (i = 0, ptr = _game->_starSystems; i < _game->_starSystemCount;
+		i++, ptr++) {
+		if (_curStar != (int)i) {
+			if (!starInLayer(x, y, ptr)) {
+				drawStar(x, y, ptr, 0);
+			}
+
+			continue;
+		}
+
+		sx = starX(ptr->x);
+		sy = starY(ptr->y);
+
+		if (_game->isStarExplored(ptr, _activePlayer) &&
+			ptr->owner >= 0) {
+
+			color = _game->_players[ptr->owner].color;
+		}
+
+		cdata = starmapHighlightColors + 3 * color;
+		drawStar(x, y, ptr, curtick);
+		drawRect(x + sx - 4, y + sy - 4, 9, 9, cdata[0], cdata[1],
+			cdata[2]);
+	}
+}
+
 int StarmapWidget::findStar(int x, int y) const {
 	unsigned i, px, py;
 
@@ -275,6 +338,10 @@ void StarmapWidget::highlightStar(int id) {
 		throw std::invalid_argument("Star ID out of range");
 	}
 
+	if (_curStar != id) {
+		invalidateMap();
+	}
+
 	_curStar = id;
 	_startTick = 0;
 }
@@ -295,6 +362,14 @@ void StarmapWidget::setStarSelectCallback(const GuiCallback &callback) {
 	_onStarSelect = callback;
 }
 
+void StarmapWidget::invalidateMap(void) {
+	if (_layerValid) {
+		freeTexture(_layerTexture);
+	}
+
+	_layerValid = 0;
+}
+
 void StarmapWidget::handleMouseMove(int x, int y, unsigned buttons) {
 	int star = findStar(x, y);
 
@@ -326,10 +401,9 @@ void StarmapWidget::handleMouseUp(int x, int y, unsigned button) {
 	Widget::handleMouseUp(x, y, button);
 }
 
+// The cached layer includes whatever was drawn under the widget, which
+// must not change until the next invalidateMap() call
 void StarmapWidget::redraw(int x, int y, unsigned curtick) {
-	unsigned i, sx, sy, color = MAX_PLAYERS;
-	const uint8_t *cdata;
-
 	if (isHidden()) {
 		return;
 	}
@@ -338,27 +412,22 @@ void StarmapWidget::redraw(int x, int y, unsigned curtick) {
 		_startTick = curtick;
 	}
 
-	for (i = 0; i < _game->_starSystemCount; i++) {
-		const Star *ptr = _game->_starSystems + i;
-
-		if (_curStar == (int)i) {
-			sx = starX(ptr->x);
-			sy = starY(ptr->y);
-
-			if (_game->isStarExplored(ptr, _activePlayer) &&
-				ptr->owner >= 0) {
-
-				color = _game->_players[ptr->owner].color;
-			}
+	if (_layerValid && (_layerX != x || _layerY != y)) {
+		invalidateMap();
+	}
 
-			cdata = starmapHighlightColors + 3 * color;
-			drawStar(x, y, ptr, curtick);
-			drawRect(x + sx - 4, y + sy - 4, 9, 9,
-				cdata[0], cdata[1], cdata[2]);
-		} else {
-			drawStar(x, y, ptr, 0);
-		}
+	if (_layerValid) {
+		drawTexture(_layerTexture, x + getX(), y + getY());
+	} else {
+		_layerX = x;
+		_layerY = y;
+		drawLayer(x, y);
+		_layerTexture = snapshotScreen(x + getX(), y + getY(), width(),
+			height());
+		_layerValid = 1;
 	}
+
+	drawOverlay(x, y, curtick);
 }
 
 GalaxyMinimapWidget::GalaxyMinimapWidget(unsigned x, unsigned y,
@@ -366,7 +435,8 @@ GalaxyMinimapWidget::GalaxyMinimapWidget(unsigned x, unsigned y,
 	unsigned activePlayer, const char *archive, unsigned starAssets,
 	unsigned fleetAssets, const uint8_t *palette) :
 	StarmapWidget(x, y, width, height, game, activePlayer, archive,
-	starAssets, palette), _curFleet(NULL), _selFleet(NULL), _startTick(0) {
+	starAssets, palette), _curFleet(NULL), _selFleet(NULL), _startTick(0),
+	_gridValid(0) {
 
 	unsigned i;
 
@@ -425,6 +495,13 @@ const Image *GalaxyMinimapWidget::getFleetSprite(const Fleet *f) {
 	return (const Image*)_fleetimg[color];
 }
 
+int GalaxyMinimapWidget::fleetInLayer(int x, int y, const Fleet *f) {
+	const Image *img = getFleetSprite(f);
+
+	return f != _selFleet && layerContains(x + fleetX(f), y + fleetY(f),
+		img->width(), img->height());
+}
+
 void GalaxyMinimapWidget::drawFleet(int x, int y, const Fleet *f,
 	unsigned curtick) {
 
@@ -438,94 +515,159 @@ void GalaxyMinimapWidget::drawFleet(int x, int y, const Fleet *f,
 	img->draw(x + fleetX(f), y + fleetY(f), frame);
 }
 
-void GalaxyMinimapWidget::drawStar(int x, int y, const Star *s,
-	unsigned curtick) {
+void GalaxyMinimapWidget::drawLayer(int x, int y) {
+	unsigned i;
+	const Star *ptr;
+	const BilistNode<Fleet> *fnode;
 
-	unsigned frame = 0;
-	int curstar, selstar;
-	const Star *selptr, *curptr;
+	for (i = 0, ptr = _game->_starSystems; i < _game->_starSystemCount;
+		i++, ptr++) {
+		if (starInLayer(x, y, ptr)) {
+			drawStar(x, y, ptr, 0);
+		}
+
+		// FIXME: draw draw up to 3 fleets from both groups
+		fnode = ptr->getOrbitingFleets();
+
+		if (fnode && fnode->data && fleetInLayer(x, y, fnode->data)) {
+			drawFleet(x, y, fnode->data, 0);
+		}
+
+		fnode = ptr->getLeavingFleets();
+
+		if (fnode && fnode->data && fleetInLayer(x, y, fnode->data)) {
+			drawFleet(x, y, fnode->data, 0);
+		}
+	}
+
+	for (fnode = _game->getMovingFleets(); fnode; fnode = fnode->next()) {
+		if (fnode->data && fleetInLayer(x, y, fnode->data)) {
+			drawFleet(x, y, fnode->data, 0);
+		}
+	}
+}
+
+void GalaxyMinimapWidget::drawOverlay(int x, int y, unsigned curtick) {
+	unsigned i, frame;
+	int sx, sy, curstar, selstar;
+	const Star *ptr;
+	const BilistNode<Fleet> *fnode;
 	const uint8_t *color;
 
-	StarmapWidget::drawStar(x, y, s, 0);
+	if (!_startTick) {
+		_startTick = curtick;
+	}
 
 	selstar = selectedStar();
-	selptr = selstar < 0 ? NULL : _game->_starSystems + selstar;
 	curstar = highlightedStar();
-	curptr = curstar < 0 ? NULL : _game->_starSystems + curstar;
-	x += starX(s->x);
-	y += starY(s->y);
 
-	if (s == selptr) {
-		frame = bounceFrame(curtick - _startTick, 200,
-			STARSEL_FRAMECOUNT);
-		color = minimapStarSelColors + frame * 3;
-		drawRect(x - 5, y - 5, 11, 11, color[0], color[1], color[2]);
-	} else if (s == curptr) {
-		drawRect(x - 5, y - 5, 11, 11, RGB(0x006000));
-	}
-}
+	for (i = 0, ptr = _game->_starSystems; i < _game->_starSystemCount;
+		i++, ptr++) {
+		if (!starInLayer(x, y, ptr)) {
+			drawStar(x, y, ptr, 0);
+		}
 
-void GalaxyMinimapWidget::findObject(unsigned x, unsigned y, int *rstar,
-	Fleet **rfleet) {
+		fnode = ptr->getOrbitingFleets();
 
-	unsigned i, px, py;
-	const BilistNode<Fleet> *fnode;
+		if (fnode && fnode->data && !fleetInLayer(x, y, fnode->data)) {
+			drawFleet(x, y, fnode->data, curtick);
+		}
 
-	*rstar = -1;
-	*rfleet = NULL;
-	fnode = _game->getMovingFleets();
+		fnode = ptr->getLeavingFleets();
 
-	for (; fnode; fnode = fnode->next()) {
-		if (!fnode->data) {
-			continue;
+		if (fnode && fnode->data && !fleetInLayer(x, y, fnode->data)) {
+			drawFleet(x, y, fnode->data, curtick);
 		}
 
-		if (touchesFleet(x, y, fnode->data)) {
-			*rfleet = fnode->data;
-			return;
+		sx = x + starX(ptr->x);
+		sy = y + starY(ptr->y);
+
+		if ((int)i == selstar) {
+			frame = bounceFrame(curtick - _startTick, 200,
+				STARSEL_FRAMECOUNT);
+			color = minimapStarSelColors + frame * 3;
+			drawRect(sx - 5, sy - 5, 11, 11, color[0], color[1],
+				color[2]);
+		} else if ((int)i == curstar) {
+			drawRect(sx - 5, sy - 5, 11, 11, RGB(0x006000));
 		}
 	}
 
-	for (i = 0; i < _game->_starSystemCount; i++) {
-		const Star *ptr = _game->_starSystems + i;
+	for (fnode = _game->getMovingFleets(); fnode; fnode = fnode->next()) {
+		if (fnode->data && !fleetInLayer(x, y, fnode->data)) {
+			drawFleet(x, y, fnode->data, curtick);
+		}
+	}
+}
 
-		fnode = ptr->getOrbitingFleets();
+void GalaxyMinimapWidget::addFleetBounds(const Fleet *f) {
+	const Image *img = getFleetSprite(f);
 
-		if (fnode && fnode->data && touchesFleet(x, y,
-			fnode->data)) {
+	_objectGrid.add(fleetX(f), fleetY(f), img->width(), img->height(), -1,
+		(void*)f);
+}
 
-			*rfleet = fnode->data;
-			return;
-		}
+// Objects are added in hit test priority order
+void GalaxyMinimapWidget::buildObjectGrid(void) {
+	unsigned i;
+	const Star *ptr;
+	const BilistNode<Fleet> *fnode;
 
-		fnode = ptr->getLeavingFleets();
+	_objectGrid.clear();
 
-		if (fnode && fnode->data && touchesFleet(x, y,
-			fnode->data)) {
+	for (fnode = _game->getMovingFleets(); fnode; fnode = fnode->next()) {
+		if (fnode->data) {
+			addFleetBounds(fnode->data);
+		}
+	}
 
-			*rfleet = fnode->data;
-			return;
+	for (i = 0; i < _game->_starSystemCount; i++) {
+		ptr = _game->_starSystems + i;
+		fnode = ptr->getOrbitingFleets();
+
+		if (fnode && fnode->data) {
+			addFleetBounds(fnode->data);
 		}
 
-		px = starX(ptr->x);
-		py = starY(ptr->y);
+		fnode = ptr->getLeavingFleets();
 
-		if (isInRect(x, y, px - 4, py - 4, 9, 9)) {
-			*rstar = i;
-			return;
+		if (fnode && fnode->data) {
+			addFleetBounds(fnode->data);
 		}
+
+		_objectGrid.add(starX(ptr->x) - 4, starY(ptr->y) - 4, 9, 9, i);
 	}
+
+	_gridValid = 1;
 }
 
-int GalaxyMinimapWidget::touchesFleet(unsigned x, unsigned y, const Fleet *f) {
-	unsigned fx, fy;
-	const Image *img;
+void GalaxyMinimapWidget::findObject(unsigned x, unsigned y, int *rstar,
+	Fleet **rfleet) {
 
-	img = getFleetSprite(f);
-	fx = fleetX(f);
-	fy = fleetY(f);
+	int id;
+	void *data;
+
+	*rstar = -1;
+	*rfleet = NULL;
 
-	return isInRect(x, y, fx, fy, img->width(), img->height());
+	if (!_gridValid) {
+		buildObjectGrid();
+	}
+
+	if (!_objectGrid.find(x, y, &id, &data)) {
+		return;
+	}
+
+	if (data) {
+		*rfleet = (Fleet*)data;
+	} else {
+		*rstar = id;
+	}
+}
+
+void GalaxyMinimapWidget::invalidateMap(void) {
+	StarmapWidget::invalidateMap();
+	_gridValid = 0;
 }
 
 Fleet *GalaxyMinimapWidget::highlightedFleet(void) {
@@ -542,6 +684,10 @@ void GalaxyMinimapWidget::highlightFleet(Fleet *f) {
 }
 
 void GalaxyMinimapWidget::selectFleet(Fleet *f) {
+	if (f != _selFleet) {
+		StarmapWidget::invalidateMap();
+	}
+
 	_selFleet = f;
 	_startTick = 0;
 }
@@ -614,49 +760,11 @@ void GalaxyMinimapWidget::handleMouseUp(int x, int y, unsigned button) {
 	Widget::handleMouseUp(x, y, button);
 }
 
-void GalaxyMinimapWidget::redraw(int x, int y, unsigned curtick) {
-	unsigned i;
-	const BilistNode<Fleet> *fnode;
-
-	if (isHidden()) {
-		return;
-	}
-
-	if (!_startTick) {
-		_startTick = curtick;
-	}
-
-	for (i = 0; i < _game->_starSystemCount; i++) {
-		const Star *ptr = _game->_starSystems + i;
-
-		drawStar(x, y, ptr, curtick);
-
-		// FIXME: draw draw up to 3 fleets from both groups
-		fnode = ptr->getOrbitingFleets();
-
-		if (fnode && fnode->data) {
-			drawFleet(x, y, fnode->data, curtick);
-		}
-
-		fnode = ptr->getLeavingFleets();
-
-		if (fnode && fnode->data) {
-			drawFleet(x, y, fnode->data, curtick);
-		}
-	}
-
-	for (fnode = _game->getMovingFleets(); fnode; fnode = fnode->next()) {
-		if (!fnode->data) {
-			continue;
-		}
-
-		drawFleet(x, y, fnode->data, curtick);
-	}
-}
-
 GalaxyView::GalaxyView(GameState *game) : _game(game), _zoom(0), _zoomX(0),
 	_zoomY(0), _startTick(0), _selTick(0), _curStar(-1), _activePlayer(-1),
-	_curFleet(NULL) {
+	_curFleet(NULL), _gridZoom(0), _gridX(0), _gridY(0), _gridValid(0),
+	_layerTexture(0), _layerZoom(0), _layerX(0), _layerY(0), _layerValid(0),
+	_layerPlayer(-1) {
 
 	uint8_t tpal[PALSIZE];
 	const uint8_t *pal;
@@ -732,6 +840,10 @@ GalaxyView::GalaxyView(GameState *game) : _game(game), _zoom(0), _zoomX(0),
 }
 
 GalaxyView::~GalaxyView(void) {
+	if (_layerValid) {
+		freeTexture(_layerTexture);
+	}
+
 	delete _game;
 }
 
@@ -950,15 +1062,52 @@ const Image *GalaxyView::getStarSprite(const Star *s) const {
 	return (const Image*)_starimg[s->spectralClass][_zoom + s->size];
 }
 
-int GalaxyView::touchesFleet(unsigned x, unsigned y, const Fleet *f) const {
-	int fx, fy;
+void GalaxyView::addFleetBounds(const Fleet *f) {
+	const Image *img = getFleetSprite(f);
+
+	_objectGrid.add(transformFleetX(f), transformFleetY(f), img->width(),
+		img->height(), -1, (void*)f);
+}
+
+// Objects are added in hit test priority order
+void GalaxyView::buildObjectGrid(void) {
+	unsigned i;
+	const Star *ptr;
 	const Image *img;
+	const BilistNode<Fleet> *fnode;
 
-	img = getFleetSprite(f);
-	fx = transformFleetX(f);
-	fy = transformFleetY(f);
+	_objectGrid.clear();
+
+	for (fnode = _game->getMovingFleets(); fnode; fnode = fnode->next()) {
+		if (fnode->data) {
+			addFleetBounds(fnode->data);
+		}
+	}
+
+	for (i = 0; i < _game->_starSystemCount; i++) {
+		ptr = _game->_starSystems + i;
+		fnode = ptr->getOrbitingFleets();
+
+		if (fnode && fnode->data) {
+			addFleetBounds(fnode->data);
+		}
+
+		fnode = ptr->getLeavingFleets();
+
+		if (fnode && fnode->data) {
+			addFleetBounds(fnode->data);
+		}
+
+		img = getStarSprite(ptr);
+		_objectGrid.add(transformX(ptr->x) - img->width() / 2,
+			transformY(ptr->y) - img->height() / 2, img->width(),
+			img->height(), i);
+	}
 
-	return isInRect(x, y, fx, fy, img->width(), img->height());
+	_gridZoom = _zoom;
+	_gridX = _zoomX;
+	_gridY = _zoomY;
+	_gridValid = 1;
 }
 
 void GalaxyView::selectPlayer(void) {
@@ -1011,56 +1160,40 @@ void GalaxyView::setPlayer(int player, int a, int b) {
 void GalaxyView::findObject(unsigned x, unsigned y, int *rstar,
 	Fleet **rfleet) {
 
-	unsigned i, sx, sy;
-	const Image *img;
-	const BilistNode<Fleet> *fnode;
+	int id;
+	void *data;
 
 	*rstar = -1;
 	*rfleet = NULL;
-	fnode = _game->getMovingFleets();
 
-	for (; fnode; fnode = fnode->next()) {
-		if (!fnode->data) {
-			continue;
-		}
-
-		if (touchesFleet(x, y, fnode->data)) {
-			*rfleet = fnode->data;
-			return;
-		}
+	if (!_gridValid || _gridZoom != _zoom || _gridX != _zoomX ||
+		_gridY != _zoomY) {
+		buildObjectGrid();
 	}
 
-	for (i = 0; i < _game->_starSystemCount; i++) {
-		const Star *ptr = _game->_starSystems + i;
-
-		fnode = ptr->getOrbitingFleets();
-
-		if (fnode && fnode->data && touchesFleet(x, y,
-			fnode->data)) {
-
-			*rfleet = fnode->data;
-			return;
-		}
-
-		fnode = ptr->getLeavingFleets();
-
-		if (fnode && fnode->data && touchesFleet(x, y,
-			fnode->data)) {
+	if (!_objectGrid.find(x, y, &id, &data)) {
+		return;
+	}
 
-			*rfleet = fnode->data;
-			return;
-		}
+	if (data) {
+		*rfleet = (Fleet*)data;
+	} else {
+		*rstar = id;
+	}
+}
 
-		img = getStarSprite(ptr);
-		sx = transformX(ptr->x) - img->width() / 2;
-		sy = transformY(ptr->y) - img->height() / 2;
+void GalaxyView::invalidateObjects(void) {
+	_gridValid = 0;
+}
 
-		if (isInRect(x, y, sx, sy, img->width(), img->height())) {
-			*rstar = i;
-			return;
-		}
+void GalaxyView::invalidateStarmap(void) {
+	if (_layerValid) {
+		freeTexture(_layerTexture);
 	}
+
+	_layerValid = 0;
 }
+
 void GalaxyView::clickGalaxyMap(int x, int y, int arg) {
 	int star = -1;
 	Fleet *f = NULL;
@@ -1097,9 +1230,9 @@ void GalaxyView::leaveGalaxyMap(int x, int y, int arg) {
 	_curFleet = NULL;
 }
 
-void GalaxyView::drawStar(const Star *s, Font *fnt, unsigned curtick) {
+void GalaxyView::drawStar(const Star *s, Font *fnt, unsigned frame) {
 	int x, y, xoff, idx;
-	unsigned i, owner, color, width, tmp, step, total = 0, frame = 0;
+	unsigned i, owner, color, width, tmp, step, total = 0;
 	StarKnowledge explored;
 	const Image *img;
 	const Planet *pptr;
@@ -1134,11 +1267,6 @@ void GalaxyView::drawStar(const Star *s, Font *fnt, unsigned curtick) {
 		}
 	}
 
-	if (_curStar >= 0 && s == _game->_starSystems + _curStar) {
-		frame = loopFrame(curtick - _selTick, STAR_ANIM_SPEED,
-			GALAXY_ANIM_LENGTH);
-	}
-
 	explored = _game->isStarExplored(s, _activePlayer);
 
 	if (!explored) {
@@ -1286,31 +1414,22 @@ void GalaxyView::redrawSidebar(unsigned curtick) {
 
 void GalaxyView::open(void) {
 	_startTick = 0;
+	setRetainedMode(1);
+	// Other views may have changed fleets in the meantime
+	invalidateObjects();
 
 	if (_activePlayer < 0) {
 		selectPlayer();
 	}
 }
 
-void GalaxyView::redraw(unsigned curtick) {
-	unsigned i, frame, bhshift = 0;
-	int x, y;
-	const Image *img;
-	Font *fnt;
-	const Player *plr;
-	BilistNode<Fleet> *fnode;
-	unsigned font_sizes[] = {FONTSIZE_MEDIUM, FONTSIZE_SMALL,
-		FONTSIZE_SMALL, FONTSIZE_SMALLER};
-
-	if (!_startTick) {
-		_startTick = curtick;
-	}
-
-	if (!_selTick) {
-		_selTick = curtick;
-	}
+void GalaxyView::close(void) {
+	setRetainedMode(0);
+}
 
-	fnt = gameFonts->getFont(font_sizes[_zoom]);
+void GalaxyView::drawStarmapLayer(Font *fnt) {
+	unsigned i, count;
+	int x, y, lines[4 * MAX_STARS];
 
 	clearScreen();
 	_bg->draw(0, 0);
@@ -1324,7 +1443,7 @@ void GalaxyView::redraw(unsigned curtick) {
 	}
 
 	// Draw wormholes
-	for (i = 0; i < _game->_starSystemCount; i++) {
+	for (i = 0, count = 0; i < _game->_starSystemCount; i++) {
 		Star *s1, *s2;
 
 		s1 = _game->_starSystems + i;
@@ -1334,21 +1453,82 @@ void GalaxyView::redraw(unsigned curtick) {
 		}
 
 		s2 = _game->_starSystems + s1->wormhole;
-		drawLine(transformX(s1->x), transformY(s1->y),
-			transformX(s2->x), transformY(s2->y), 36, 36, 40);
+		lines[count++] = transformX(s1->x);
+		lines[count++] = transformY(s1->y);
+		lines[count++] = transformX(s2->x);
+		lines[count++] = transformY(s2->y);
 	}
 
-	// Draw stars and black holes
+	drawLines(lines, count / 4, 36, 36, 40);
+
+	// Black holes are animated and drawn separately
 	for (i = 0; i < _game->_starSystemCount; i++) {
 		Star *ptr = _game->_starSystems + i;
 
 		if (ptr->spectralClass < SpectralClass::BlackHole) {
-			drawStar(ptr, fnt, curtick);
-		} else {
+			drawStar(ptr, fnt, 0);
+		}
+	}
+
+	_layerTexture = snapshotScreen(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+	_layerZoom = _zoom;
+	_layerX = _zoomX;
+	_layerY = _zoomY;
+	_layerPlayer = _activePlayer;
+	_layerValid = 1;
+}
+
+const char *GalaxyView::name(void) const {
+	return "GalaxyView";
+}
+
+void GalaxyView::redraw(unsigned curtick) {
+	unsigned i, frame, bhshift = 0;
+	int x, y;
+	const Image *img;
+	Font *fnt;
+	const Player *plr;
+	BilistNode<Fleet> *fnode;
+	unsigned font_sizes[] = {FONTSIZE_MEDIUM, FONTSIZE_SMALL,
+		FONTSIZE_SMALL, FONTSIZE_SMALLER};
+
+	if (!_startTick) {
+		_startTick = curtick;
+	}
+
+	if (!_selTick) {
+		_selTick = curtick;
+	}
+
+	fnt = gameFonts->getFont(font_sizes[_zoom]);
+
+	if (_layerValid && (_layerZoom != _zoom || _layerX != _zoomX ||
+		_layerY != _zoomY || _layerPlayer != _activePlayer)) {
+		invalidateStarmap();
+	}
+
+	if (!_layerValid) {
+		drawStarmapLayer(fnt);
+	} else {
+		drawTexture(_layerTexture, 0, 0);
+	}
+
+	// Redraw highlighted star name with animated color
+	if (_curStar >= 0 && _game->_starSystems[_curStar].spectralClass <
+		SpectralClass::BlackHole) {
+		frame = loopFrame(curtick - _selTick, STAR_ANIM_SPEED,
+			GALAXY_ANIM_LENGTH);
+		drawStar(_game->_starSystems + _curStar, fnt, frame);
+	}
+
+	// Draw black holes and fleets
+	for (i = 0; i < _game->_starSystemCount; i++) {
+		Star *ptr = _game->_starSystems + i;
+
+		if (ptr->spectralClass >= SpectralClass::BlackHole) {
 			x = transformX(ptr->x);
 			y = transformY(ptr->y);
 			img = getStarSprite(ptr);
-
 			// Draw different frame for each black hole
 			// using bhshift as a counter
 			frame = (curtick - _startTick) / 120 + bhshift++;
@@ -1357,7 +1537,6 @@ void GalaxyView::redraw(unsigned curtick) {
 				frame);
 		}
 
-
 		// TODO: Draw up to 3 fleets from both groups
 		fnode = ptr->getOrbitingFleets();
 
@@ -1431,7 +1610,11 @@ void GalaxyView::clickZoomInButton(int x, int y, int arg) STUB(this)
 
 void GalaxyView::clickZoomOutButton(int x, int y, int arg) STUB(this)
 
-void GalaxyView::clickTurnButton(int x, int y, int arg) STUB(this)
+// Turn processing does not exist yet, ending the turn only writes the
+// current state to the autosave slot
+void GalaxyView::clickTurnButton(int x, int y, int arg) {
+	autosaveGame(_game);
+}
 
 void GalaxyView::clickTreasuryInfo(int x, int y, int arg) STUB(this)
 
@@ -1518,6 +1701,10 @@ void SelectPlayerView::initWidgets(void) {
 	}
 }
 
+const char *SelectPlayerView::name(void) const {
+	return "SelectPlayerView";
+}
+
 void SelectPlayerView::redraw(unsigned curtick) {
 	unsigned i, x, y, h, color;
 	const char *player_fmt;
@@ -1616,6 +1803,7 @@ PlanetsListView::PlanetsListView(GameState *game, int activePlayer) :
 	}
 
 	initWidgets();
+	_table.build(_game, _activePlayer);
 	changeFilter(0, 0, 0);
 
 	for (i = 0; i < _game->_shipCount; i++) {
@@ -1869,6 +2057,10 @@ void PlanetsListView::handleSelectStar(int x, int y, int arg) {
 	new ErrorWindow(this, buf.c_str());
 }
 
+const char *PlanetsListView::name(void) const {
+	return "PlanetsListView";
+}
+
 void PlanetsListView::redraw(unsigned curtick) {
 	Font *fnt, *smallFnt;
 	unsigned i, y, climate, color, offset = _scroll->position();
@@ -2077,95 +2269,58 @@ void PlanetsListView::clickSlot(int x, int y, int arg) {
 }
 
 void PlanetsListView::changeFilter(int x, int y, int arg) {
-	unsigned i, j, count, climate;
-	int f_enemy, f_gravity, f_env, f_mineral, f_range;
-	int owner;
-	const Planet *ptr;
-	const Star *sptr;
-	const Player *player = _game->_players + _activePlayer;
-	const BilistNode<Fleet> *node;
-
-	f_enemy = _enemyFilter->value();
-	f_gravity = _gravityFilter->value();
-	f_env = _envFilter->value();
-	f_mineral = _mineralFilter->value();
-	f_range = _rangeFilter->value();
-
-	if (f_range) {
+	unsigned i, count, rows, required;
+	uint8_t pass[MAX_PLANETS];
+	const uint8_t *flags = _table.flags();
+	const uint8_t *climate = _table.climate();
+	const uint8_t *minerals = _table.minerals();
+	const int8_t *gravity = _table.gravity();
+	const int8_t *owner = _table.owner();
+	const uint16_t *planets = _table.planets();
+
+	rows = _table.rowCount();
+	required = PLANET_ROW_HABITABLE | PLANET_ROW_CHARTED;
+
+	// FIXME: Implement range filter
+	if (_rangeFilter->value()) {
 		_rangeFilter->setValue(0);
 		new MessageBoxWindow(this, "Range filter not implemented");
 	}
 
-	for (i = 0, count = 0; i < _game->_starSystemCount; i++) {
-		sptr = _game->_starSystems + i;
+	// Ignore invalid, unknown and own planets
+	for (i = 0; i < rows; i++) {
+		pass[i] = (flags[i] & required) == required &&
+			owner[i] != _activePlayer;
+	}
 
-		if (_game->isStarExplored(sptr, _activePlayer) < STAR_CHARTED) {
-			continue;
+	// Drop star systems with hostile colonies or fleets
+	if (_enemyFilter->value()) {
+		for (i = 0; i < rows; i++) {
+			pass[i] &= !(flags[i] & PLANET_ROW_HOSTILE);
 		}
+	}
 
-		if (f_enemy) {
-			// Hostile colony in this star system
-			if (sptr->hasColony & ~(1 << _activePlayer)) {
-				continue;
-			}
-
-			node = sptr->getOrbitingFleets();
-
-			for (; node; node = node->next()) {
-				if (!node->data) {
-					continue;
-				}
-
-				if (node->data->getOwner() != _activePlayer) {
-					break;
-				}
-			}
-
-			// Hostile fleet orbiting star
-			// FIXME: ignore hidden fleets (known but unvisited
-			// star)
-			if (node) {
-				continue;
-			}
+	if (_gravityFilter->value()) {
+		for (i = 0; i < rows; i++) {
+			pass[i] &= gravity[i] >= 0;
 		}
+	}
 
-		// FIXME: Implement range filter
-
-		for (j = 0; j < MAX_ORBITS; j++) {
-			if (sptr->planetIndex[j] < 0) {
-				continue;
-			}
-
-			ptr = _game->_planets + sptr->planetIndex[j];
-			owner = -1;
-
-			if (ptr->colony >= 0) {
-				owner = _game->_colonies[ptr->colony].owner;
-			}
-
-			// Ignore invalid and own planets
-			if (ptr->type != PlanetType::HABITABLE ||
-				owner == _activePlayer) {
-				continue;
-			}
-
-			if (f_gravity &&
-				player->gravityPenalty(ptr->gravity) < 0) {
-				continue;
-			}
-
-			climate = _game->planetClimate(sptr->planetIndex[j]);
-
-			if (f_env && climate < PlanetClimate::DESERT) {
-				continue;
-			}
+	if (_envFilter->value()) {
+		for (i = 0; i < rows; i++) {
+			pass[i] &= climate[i] >= PlanetClimate::DESERT;
+		}
+	}
 
-			if (f_mineral &&
-				ptr->minerals < PlanetMinerals::ABUNDANT) {
-				continue;
-			}
+	if (_mineralFilter->value()) {
+		for (i = 0; i < rows; i++) {
+			pass[i] &= minerals[i] >= PlanetMinerals::ABUNDANT;
+		}
+	}
 
-			_planets[count++] = sptr->planetIndex[j];
+	for (i = 0, count = 0; i < rows; i++) {
+		if (pass[i]) {
+			_planets[count++] = planets[i];
 		}
 	}
 
@@ -2175,12 +2330,22 @@ void PlanetsListView::changeFilter(int x, int y, int arg) {
 }
 
 void PlanetsListView::changeSort(int x, int y, int arg) {
-	gamestate_cmp_func cmplist[3] = {
-		cmpPlanetClimate, cmpPlanetMinerals, cmpPlanetMaxPop
+	unsigned i, count, choice = _sortChoice->value();
+	unsigned columns[PLANET_SORT_COLUMNS] = {
+		PLANET_SORT_CLIMATE, PLANET_SORT_MINERALS, PLANET_SORT_MAXPOP
 	};
+	unsigned order[PLANET_SORT_COLUMNS];
+
+	// Selected column first, the remaining ones break ties
+	order[0] = columns[choice];
 
-	_game->sort_ids(_planets, _planetCount, _activePlayer,
-		cmplist[_sortChoice->value()]);
+	for (i = 0, count = 1; i < PLANET_SORT_COLUMNS; i++) {
+		if (i != choice) {
+			order[count++] = columns[i];
+		}
+	}
+
+	_table.sortPlanets(_planets, _planetCount, order, count);
 }
 
 // FIXME: Implement sending colony and outpost ships
@@ -2297,7 +2462,11 @@ void MainMenuWindow::showHelp(int x, int y, int arg) {
 
 void MainMenuWindow::clickNew(int x, int y, int arg) STUB(_parent)
 
-void MainMenuWindow::clickSave(int x, int y, int arg) STUB(_parent)
+void MainMenuWindow::clickSave(int x, int y, int arg) {
+	if (saveGame(_parent, _game)) {
+		close();
+	}
+}
 
 void MainMenuWindow::clickLoad(int x, int y, int arg) {
 	new LoadGameWindow(_parent, 0);
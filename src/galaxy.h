@@ -35,6 +35,9 @@ private:
 	GuiCallback _onStarHighlight, _onStarSelect;
 	int _curStar, _selStar;
 	unsigned _startTick;
+	// Cached rendering of objects which are not animated
+	unsigned _layerTexture;
+	int _layerValid, _layerX, _layerY;
 
 protected:
 	GameState *_game;
@@ -44,7 +47,16 @@ protected:
 	unsigned starY(unsigned y) const;
 	const Image *getStarSprite(const Star *s);
 
-	virtual void drawStar(int x, int y, const Star *s, unsigned curtick);
+	// Objects which cross the widget border are not cached
+	int layerContains(int x, int y, unsigned width, unsigned height) const;
+	int starInLayer(int x, int y, const Star *s);
+
+	void drawStar(int x, int y, const Star *s, unsigned curtick);
+	// Draw non-animated objects which can be cached until the next
+	// invalidateMap() call
+	virtual void drawLayer(int x, int y);
+	// Draw the remaining objects on top of the cached layer
+	virtual void drawOverlay(int x, int y, unsigned curtick);
 	int findStar(int x, int y) const;
 
 	void onStarHighlight(int x, int y);
@@ -65,6 +77,9 @@ public:
 	void setStarHighlightCallback(const GuiCallback &callback);
 	void setStarSelectCallback(const GuiCallback &callback);
 
+	// Call after game state changes
+	virtual void invalidateMap(void);
+
 	void handleMouseMove(int x, int y, unsigned buttons);
 	void handleMouseUp(int x, int y, unsigned button);
 
@@ -77,18 +92,23 @@ private:
 	GuiCallback _onFleetHighlight, _onFleetSelect;
 	Fleet *_curFleet, *_selFleet;
 	unsigned _startTick;
+	HitGrid _objectGrid;
+	int _gridValid;
 
 protected:
 	unsigned fleetX(const Fleet *f);
 	unsigned fleetY(const Fleet *f);
 	const Image *getFleetSprite(const Fleet *f);
 
+	int fleetInLayer(int x, int y, const Fleet *f);
 	void drawFleet(int x, int y, const Fleet *f,
 		unsigned curtick);
-	void drawStar(int x, int y, const Star *s, unsigned curtick);
+	void drawLayer(int x, int y);
+	void drawOverlay(int x, int y, unsigned curtick);
 
+	void addFleetBounds(const Fleet *f);
+	void buildObjectGrid(void);
 	void findObject(unsigned x, unsigned y, int *rstar, Fleet **rfleet);
-	int touchesFleet(unsigned x, unsigned y, const Fleet *f);
 
 public:
 	GalaxyMinimapWidget(unsigned x, unsigned y, unsigned width,
@@ -108,10 +128,10 @@ public:
 	void setFleetHighlightCallback(const GuiCallback &callback);
 	void setFleetSelectCallback(const GuiCallback &callback);
 
+	void invalidateMap(void);
+
 	void handleMouseMove(int x, int y, unsigned buttons);
 	void handleMouseUp(int x, int y, unsigned button);
-
-	void redraw(int x, int y, unsigned curtick);
 };
 
 class GalaxyView : public GuiView {
@@ -125,6 +145,13 @@ private:
 	unsigned _zoom, _zoomX, _zoomY, _startTick, _selTick;
 	int _curStar, _activePlayer;
 	Fleet *_curFleet;
+	// Screen bounds of stars and fleets for the current zoom and scroll
+	HitGrid _objectGrid;
+	unsigned _gridZoom, _gridX, _gridY;
+	int _gridValid;
+	// Pre-rendered background, nebulas, wormholes and stars
+	unsigned _layerTexture, _layerZoom, _layerX, _layerY;
+	int _layerValid, _layerPlayer;
 
 	void initWidgets(void);
 
@@ -136,7 +163,8 @@ protected:
 	int transformFleetY(const Fleet *f) const;
 	const Image *getFleetSprite(const Fleet *f) const;
 	const Image *getStarSprite(const Star *s) const;
-	int touchesFleet(unsigned x, unsigned y, const Fleet *f) const;
+	void addFleetBounds(const Fleet *f);
+	void buildObjectGrid(void);
 
 	void selectPlayer(void);
 	void setPlayer(int player, int a, int b);
@@ -146,8 +174,9 @@ protected:
 	void touchGalaxyMap(int x, int y, int arg);
 	void leaveGalaxyMap(int x, int y, int arg);
 
-	void drawStar(const Star *s, Font *fnt, unsigned curtick);
+	void drawStar(const Star *s, Font *fnt, unsigned frame);
 	void drawFleet(const Fleet *f, unsigned curtick);
+	void drawStarmapLayer(Font *fnt);
 	void redrawSidebar(unsigned curtick);
 
 public:
@@ -157,7 +186,15 @@ public:
 	~GalaxyView(void);
 
 	void open(void);
+	void close(void);
+
+	// Call after fleets change position or status. The object grid is
+	// rebuilt in full on the next hit test, there are no per-fleet updates.
+	void invalidateObjects(void);
+	// Call after star ownership, exploration or colonies change
+	void invalidateStarmap(void);
 
+	const char *name(void) const;
 	void redraw(unsigned curtick);
 
 	void showHelp(int x, int y, int arg);
@@ -194,6 +231,7 @@ private:
 public:
 	SelectPlayerView(const GameState *game, const GuiCallback &callback);
 
+	const char *name(void) const;
 	void redraw(unsigned curtick);
 
 	void highlightPlayer(int x, int y, int arg);
@@ -212,6 +250,7 @@ private:
 	int _scrollgrab, _curslot, _activePlayer;
 	ImageAsset _bg, _planetimg[PLANET_CLIMATE_COUNT][PLANET_SIZE_COUNT];
 	ImageAsset _shipimg;
+	PlanetTable _table;
 	unsigned _planetCount, _planets[MAX_PLANETS];
 	// Ships heading to a specific planet
 	int _colonyShips[MAX_PLANETS], _outpostShips[MAX_PLANETS];
@@ -226,6 +265,7 @@ protected:
 public:
 	PlanetsListView(GameState *game, int activePlayer);
 	
+	const char *name(void) const;
 	void redraw(unsigned curtick);
 
 	void handleMouseMove(int x, int y, unsigned buttons);
@@ -18,12 +18,40 @@
  */
 
 #include <cstring>
+#include <cstdarg>
+#include <new>
 #include <stdexcept>
 #include "lang.h"
 #include "lbx.h"
+#include "profiler.h"
+#include "system.h"
 #include "gamestate.h"
 
+// Savegame layout, each list section starts with 16bit item count except
+// leaders. Record sizes must match what the load() methods read.
+#define CONFIG_OFFSET 0
+#define CONFIG_SIZE 59
+#define GALAXY_OFFSET 0x31be4
+#define GALAXY_SIZE 32
 #define COLONY_COUNT_OFFSET 0x25b
+#define COLONY_RECORD_SIZE 361
+#define PLANET_COUNT_OFFSET \
+	(COLONY_COUNT_OFFSET + 2 + MAX_COLONIES * COLONY_RECORD_SIZE)
+#define PLANET_RECORD_SIZE 17
+#define STAR_COUNT_OFFSET \
+	(PLANET_COUNT_OFFSET + 2 + MAX_PLANETS * PLANET_RECORD_SIZE)
+#define STAR_RECORD_SIZE 113
+#define LEADER_OFFSET (STAR_COUNT_OFFSET + 2 + MAX_STARS * STAR_RECORD_SIZE)
+#define LEADER_RECORD_SIZE 59
+#define PLAYER_COUNT_OFFSET (LEADER_OFFSET + LEADER_COUNT * LEADER_RECORD_SIZE)
+#define PLAYER_RECORD_SIZE 3753
+#define SHIP_COUNT_OFFSET \
+	(PLAYER_COUNT_OFFSET + 2 + MAX_PLAYERS * PLAYER_RECORD_SIZE)
+#define SHIP_RECORD_SIZE 129
+
+// Checksum file written next to each savegame by save() and autosave()
+#define SAVEGAME_SUM_SUFFIX ".sum"
+#define SAVEGAME_SUM_MAGIC 0x4d55534f // "OSUM"
 
 const unsigned galaxySizeFactors[GALAXY_ZOOM_LEVELS] = {10, 15, 20, 30};
 
@@ -97,6 +125,128 @@ static const int shipCrewDefenseBonuses[MAX_SHIP_CREW_LEVELS] = {
 	0, 15, 30, 50, 75
 };
 
+struct AutosaveJob {
+	MemoryWriteStream *data;
+	char *filename;
+};
+
+static Mutex autosave_mutex;
+static Thread autosave_thread;
+static AutosaveJob autosave_pending = {NULL, NULL};
+static int autosave_active = 0;
+
+// Write fixed size string field but keep the last byte from the savegame
+// image, load() replaces it with null terminator
+static void writeString(SeekableWriteStream &stream, const char *str,
+	size_t size) {
+
+	stream.write(str, size - 1);
+	stream.seek(1, SEEK_CUR);
+}
+
+// 64bit FNV-1a
+static uint64_t imageChecksum(const uint8_t *data, size_t size) {
+	uint64_t ret = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		ret = (ret ^ data[i]) * 0x100000001b3ULL;
+	}
+
+	return ret;
+}
+
+// Returns 0 if the savegame has no valid checksum file
+static uint64_t readSaveChecksum(const char *filename) {
+	uint64_t ret;
+	File fr;
+	StringBuffer sumname(filename);
+
+	sumname.append(SAVEGAME_SUM_SUFFIX);
+
+	if (!fr.open(sumname.c_str()) ||
+		fr.readUint32LE() != SAVEGAME_SUM_MAGIC) {
+		return 0;
+	}
+
+	ret = fr.readUint64LE();
+	return fr.eos() ? 0 : ret;
+}
+
+// Mark savegame as written by us, see GAMESTATE_VALIDATE_TRUSTED. Errors
+// are not fatal, the savegame will just get full validation on next load.
+static void writeSaveChecksum(const char *filename,
+	const MemoryWriteStream &data) {
+	File fw;
+	StringBuffer sumname(filename);
+
+	sumname.append(SAVEGAME_SUM_SUFFIX);
+
+	if (!fw.open(sumname.c_str(), File::WRITE | File::TRUNCATE)) {
+		fprintf(stderr, "Warning: Cannot create %s\n", sumname.c_str());
+		return;
+	}
+
+	fw.writeUint32LE(SAVEGAME_SUM_MAGIC);
+	fw.writeUint64LE(imageChecksum((const uint8_t*)data.dataPtr(),
+		data.size()));
+}
+
+// Write to temporary file first so that the old savegame stays intact
+// if anything fails
+static void writeSaveFile(const char *filename, const MemoryWriteStream &data) {
+	File fw;
+	StringBuffer tmpname(filename);
+
+	tmpname.append(".tmp");
+
+	if (!fw.open(tmpname.c_str(), File::WRITE | File::TRUNCATE)) {
+		throw std::runtime_error("Cannot create savegame file");
+	}
+
+	if (fw.write(data.dataPtr(), data.size()) != data.size()) {
+		throw std::runtime_error("Cannot write savegame file");
+	}
+
+	fw.sync();
+	fw.close();
+	replace_file(tmpname.c_str(), filename);
+	writeSaveChecksum(filename, data);
+}
+
+static int autosaveWorker(void *arg) {
+	AutosaveJob job;
+
+	while (1) {
+		autosave_mutex.lock();
+		job = autosave_pending;
+		autosave_pending.data = NULL;
+		autosave_pending.filename = NULL;
+
+		if (!job.data) {
+			autosave_active = 0;
+			autosave_mutex.unlock();
+			return 0;
+		}
+
+		autosave_mutex.unlock();
+
+		try {
+			writeSaveFile(job.filename, *job.data);
+		} catch (std::exception &e) {
+			fprintf(stderr, "Autosave to %s failed: %s\n",
+				job.filename, e.what());
+		}
+
+		delete job.data;
+		delete[] job.filename;
+	}
+}
+
+void finishAutosave(void) {
+	autosave_thread.join();
+}
+
 GameConfig::GameConfig(void) {
 	version = 0;
 	memset(saveGameName, 0, SAVE_GAME_NAME_SIZE);
@@ -143,6 +293,26 @@ void GameConfig::load(ReadStream &stream) {
 	shipInitiative = stream.readUint8();
 }
 
+void GameConfig::save(SeekableWriteStream &stream) const {
+	stream.writeUint32LE(version);
+	writeString(stream, saveGameName, SAVE_GAME_NAME_SIZE);
+	stream.writeUint32LE(stardate);
+	stream.writeUint8(multiplayer);
+	stream.writeUint8(endOfTurnSummary);
+	stream.writeUint8(endOfTurnWait);
+	stream.writeUint8(randomEvents);
+	stream.writeUint8(enemyMoves);
+	stream.writeUint8(expandingHelp);
+	stream.writeUint8(autoSelectShips);
+	stream.writeUint8(animations);
+	stream.writeUint8(autoSelectColony);
+	stream.writeUint8(showRelocationLines);
+	stream.writeUint8(showGNNReport);
+	stream.writeUint8(autoDeleteTradeGoodHousing);
+	stream.writeUint8(showOnlySeriousTurnSummary);
+	stream.writeUint8(shipInitiative);
+}
+
 Nebula::Nebula(void) : x(0), y(0), type(0) {
 
 }
@@ -153,6 +323,12 @@ void Nebula::load(ReadStream &stream) {
 	type = stream.readUint8();
 }
 
+void Nebula::save(WriteStream &stream) const {
+	stream.writeUint16LE(x);
+	stream.writeUint16LE(y);
+	stream.writeUint8(type);
+}
+
 void Nebula::validate(void) const {
 	if (type >= NEBULA_TYPE_COUNT) {
 		throw std::runtime_error("Invalid nebula type");
@@ -177,6 +353,20 @@ void Galaxy::load(ReadStream &stream) {
 	nebulaCount = stream.readUint8();
 }
 
+void Galaxy::save(SeekableWriteStream &stream) const {
+	stream.writeUint8(sizeFactor);
+	stream.seek(4, SEEK_CUR); // Skip unknown data
+	stream.writeUint16LE(width);
+	stream.writeUint16LE(height);
+	stream.seek(2, SEEK_CUR); // Skip unknown data
+
+	for (int i = 0; i < MAX_NEBULAS; i++) {
+		nebulas[i].save(stream);
+	}
+
+	stream.writeUint8(nebulaCount);
+}
+
 void Galaxy::validate(void) const {
 	unsigned i;
 
@@ -219,6 +409,10 @@ void Colonist::load(ReadStream &stream) {
 	flags = raw_data >> 9;
 }
 
+void Colonist::save(WriteStream &stream) const {
+	stream.writeUint32LE(race | loyalty << 4 | job << 7 | flags << 9);
+}
+
 Colony::Colony(void) {
 	size_t i;
 
@@ -383,6 +577,96 @@ void Colony::load(ReadStream &stream) {
 	status = stream.readUint16LE();
 }
 
+void Colony::save(WriteStream &stream) const {
+	size_t i;
+
+	stream.writeUint8(owner);
+	stream.writeSint8(unknown1);
+	stream.writeSint16LE(planet);
+	stream.writeSint16LE(unknown2);
+	stream.writeUint8(is_outpost);
+	stream.writeSint8(morale);
+	stream.writeUint16LE(pollution);
+	stream.writeUint8(population);
+	stream.writeUint8(colony_type);
+
+	for (i = 0; i < MAX_POPULATION; i++) {
+		colonists[i].save(stream);
+	}
+
+	for (i = 0; i < MAX_RACES; i++) {
+		stream.writeUint16LE(race_population[i]);
+	}
+
+	for (i = 0; i < MAX_RACES; i++) {
+		stream.writeSint16LE(pop_growth[i]);
+	}
+
+	stream.writeUint8(age);
+	stream.writeUint8(food_per_farmer);
+	stream.writeUint8(industry_per_worker);
+	stream.writeUint8(research_per_scientist);
+	stream.writeSint8(max_farms);
+	stream.writeUint8(max_population);
+	stream.writeUint8(climate);
+	stream.writeUint16LE(ground_strength);
+	stream.writeUint16LE(space_strength);
+	stream.writeUint16LE(total_food);
+	stream.writeUint16LE(net_industry);
+	stream.writeUint16LE(total_research);
+	stream.writeUint16LE(total_revenue);
+	stream.writeUint8(food_consumption);
+	stream.writeUint8(industry_consumption);
+	stream.writeUint8(research_consumption);
+	stream.writeUint8(upkeep);
+	stream.writeSint16LE(food_imported);
+	stream.writeUint16LE(industry_consumed);
+	stream.writeSint16LE(research_imported);
+	stream.writeSint16LE(budget_deficit);
+	stream.writeUint8(recycled_industry);
+	stream.writeUint8(food_consumption_citizens);
+	stream.writeUint8(food_consumption_aliens);
+	stream.writeUint8(food_consumption_prisoners);
+	stream.writeUint8(food_consumption_natives);
+	stream.writeUint8(industry_consumption_citizens);
+	stream.writeUint8(industry_consumption_androids);
+	stream.writeUint8(industry_consumption_aliens);
+	stream.writeUint8(industry_consumption_prisoners);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(food_consumption_races[i]);
+	}
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(industry_consumption_races[i]);
+	}
+
+	stream.writeUint8(replicated_food);
+
+	for (i = 0; i < MAX_BUILD_QUEUE; i++) {
+		stream.writeSint16LE(build_queue[i]);
+	}
+
+	stream.writeSint16LE(finished_production);
+	stream.writeUint16LE(build_progress);
+	stream.writeUint16LE(tax_revenue);
+	stream.writeUint8(autobuild);
+	stream.writeUint16LE(unknown3);
+	stream.writeUint16LE(bought_progress);
+	stream.writeUint8(assimilation_progress);
+	stream.writeUint8(prisoner_policy);
+	stream.writeUint16LE(soldiers);
+	stream.writeUint16LE(tanks);
+	stream.writeUint8(tank_progress);
+	stream.writeUint8(soldier_progress);
+
+	for (i = 0; i < MAX_BUILDINGS; i++) {
+		stream.writeUint8(buildings[i]);
+	}
+
+	stream.writeUint16LE(status);
+}
+
 void Colony::validate(void) const {
 	unsigned i;
 
@@ -439,6 +723,25 @@ void Planet::load(ReadStream &stream) {
 	flags = stream.readUint8();
 }
 
+void Planet::save(WriteStream &stream) const {
+	stream.writeSint16LE(colony);
+	stream.writeUint8(star);
+	stream.writeUint8(orbit);
+	stream.writeUint8(type);
+	stream.writeUint8(size);
+	stream.writeUint8(gravity);
+	stream.writeUint8(unknown1);
+	stream.writeUint8(climate);
+	stream.writeUint8(bg);
+	stream.writeUint8(minerals);
+	stream.writeUint8(foodbase);
+	stream.writeUint8(terraforms);
+	stream.writeUint8(unknown2);
+	stream.writeUint8(max_pop);
+	stream.writeUint8(special);
+	stream.writeUint8(flags);
+}
+
 unsigned Planet::baseProduction(void) const {
 	return mineralProductionTable[minerals];
 }
@@ -528,6 +831,30 @@ void Leader::load(ReadStream &stream) {
 	playerIndex = stream.readSint8();
 }
 
+void Leader::save(SeekableWriteStream &stream) const {
+	int i;
+
+	writeString(stream, name, LEADER_NAME_SIZE);
+	writeString(stream, title, LEADER_TITLE_SIZE);
+	stream.writeUint8(type);
+	stream.writeUint16LE(experience);
+	stream.writeUint32LE(commonSkills);
+	stream.writeUint32LE(specialSkills);
+
+	for (i = 0; i < MAX_LEADER_TECH_SKILLS; i++) {
+		stream.writeUint8(techs[i]);
+	}
+
+	stream.writeUint8(picture);
+	stream.writeUint16LE(skillValue);
+	stream.writeUint8(level);
+	stream.writeSint16LE(location);
+	stream.writeUint8(eta);
+	stream.writeUint8(displayLevelUp);
+	stream.writeUint8(status);
+	stream.writeSint8(playerIndex);
+}
+
 unsigned Leader::expLevel(void) const {
 	unsigned i;
 
@@ -630,6 +957,15 @@ void ShipWeapon::load(ReadStream &stream) {
 	ammo = stream.readUint8();
 }
 
+void ShipWeapon::save(WriteStream &stream) const {
+	stream.writeSint16LE(type);
+	stream.writeUint8(maxCount);
+	stream.writeUint8(workingCount);
+	stream.writeUint8(arc);
+	stream.writeUint16LE(mods);
+	stream.writeUint8(ammo);
+}
+
 unsigned ShipWeapon::arcID(void) const {
 	unsigned i;
 
@@ -698,6 +1034,30 @@ void ShipDesign::load(ReadStream &stream) {
 	buildDate = stream.readUint16LE();
 }
 
+void ShipDesign::save(SeekableWriteStream &stream) const {
+	int i;
+
+	writeString(stream, name, SHIP_NAME_SIZE);
+	stream.writeUint8(size);
+	stream.writeUint8(type);
+	stream.writeUint8(shield);
+	stream.writeUint8(drive);
+	stream.writeUint8(speed);
+	stream.writeUint8(computer);
+	stream.writeUint8(armor);
+	stream.write(specials, (MAX_SHIP_SPECIALS + 7) / 8);
+
+	for (i = 0; i < MAX_SHIP_WEAPONS; i++) {
+		weapons[i].save(stream);
+	}
+
+	stream.writeUint8(picture);
+	stream.writeUint8(builder);
+	stream.writeUint16LE(cost);
+	stream.writeUint8(baseCombatSpeed);
+	stream.writeUint16LE(buildDate);
+}
+
 int ShipDesign::hasSpecial(unsigned id) const {
 	if (id >= MAX_SHIP_SPECIALS) {
 		throw std::out_of_range("Invalid ship special device ID");
@@ -900,6 +1260,40 @@ void RaceTraits::load(ReadStream &stream) {
 	warlord = stream.readUint8();
 }
 
+void RaceTraits::save(WriteStream &stream) const {
+	stream.writeUint8(government);
+	stream.writeSint8(population);
+	stream.writeSint8(farming);
+	stream.writeSint8(industry);
+	stream.writeSint8(science);
+	stream.writeSint8(money);
+	stream.writeSint8(shipDefense);
+	stream.writeSint8(shipAttack);
+	stream.writeSint8(groundCombat);
+	stream.writeSint8(spying);
+	stream.writeUint8(lowG);
+	stream.writeUint8(highG);
+	stream.writeUint8(aquatic);
+	stream.writeUint8(subterranean);
+	stream.writeUint8(largeHomeworld);
+	stream.writeSint8(richHomeworld);
+	stream.writeUint8(artifactsHomeworld);
+	stream.writeUint8(cybernetic);
+	stream.writeUint8(lithovore);
+	stream.writeUint8(repulsive);
+	stream.writeUint8(charismatic);
+	stream.writeUint8(uncreative);
+	stream.writeUint8(creative);
+	stream.writeUint8(tolerant);
+	stream.writeUint8(fantasticTraders);
+	stream.writeUint8(telepathic);
+	stream.writeUint8(lucky);
+	stream.writeUint8(omniscience);
+	stream.writeUint8(stealthyShips);
+	stream.writeUint8(transDimensional);
+	stream.writeUint8(warlord);
+}
+
 void SettlerInfo::load(ReadStream &stream) {
 	BitStream data(stream);
 
@@ -908,7 +1302,12 @@ void SettlerInfo::load(ReadStream &stream) {
 	player = data.readBitsLE(4);
 	eta = data.readBitsLE(4);
 	job = data.readBitsLE(2);
-	//data.readBitsLE(6);
+	unknown = data.readBitsLE(6);
+}
+
+void SettlerInfo::save(WriteStream &stream) const {
+	stream.writeUint32LE(sourceColony | destinationPlanet << 8 |
+		player << 16 | eta << 20 | job << 24 | unknown << 26);
 }
 
 Player::Player(void) {
@@ -1113,6 +1512,142 @@ void Player::load(SeekableReadStream &stream) {
 	stream.seek(51, SEEK_CUR);
 }
 
+void Player::save(SeekableWriteStream &stream) const {
+	int i;
+
+	stream.seek(1, SEEK_CUR);	// FIXME: unknown data
+	writeString(stream, name, PLAYER_NAME_SIZE);
+	writeString(stream, race, PLAYER_RACE_SIZE);
+	stream.writeUint8(eliminated);
+	stream.writeUint8(picture);
+	stream.writeUint8(color);
+	// 100 = Human player
+	stream.writeUint8(personality);
+	stream.writeUint8(objective);
+
+	stream.writeUint16LE(homePlayerId);
+	stream.writeUint16LE(networkPlayerId);
+	stream.writeUint8(playerDoneFlags);
+	stream.seek(2, SEEK_CUR); // Dead field
+	stream.writeUint8(researchBreakthrough);
+	stream.writeUint8(taxRate);
+	stream.writeSint32LE(BC);
+	stream.writeUint16LE(totalFreighters);
+	stream.writeSint16LE(surplusFreighters);
+	stream.writeUint16LE(commandPoints);
+	stream.writeSint16LE(usedCommandPoints);
+	stream.writeUint16LE(foodFreighted);
+	stream.writeUint16LE(settlersFreighted);
+
+	for (i = 0; i < MAX_SETTLERS; i++) {
+		settlers[i].save(stream);
+	}
+
+	stream.writeUint16LE(totalPop);
+	stream.writeUint16LE(foodProduced);
+	stream.writeUint16LE(industryProduced);
+	stream.writeUint16LE(researchProduced);
+	stream.writeUint16LE(bcProduced);
+
+	stream.writeSint16LE(surplusFood);
+	stream.writeSint16LE(surplusBC);
+
+	stream.writeSint32LE(totalMaintenance);
+	stream.writeUint16LE(buildingMaintenance);
+	stream.writeUint16LE(freighterMaintenance);
+	stream.writeUint16LE(shipMaintenance);
+	stream.writeUint16LE(spyMaintenance);
+	stream.writeUint16LE(tributeCost);
+	stream.writeUint16LE(officerMaintenance);
+
+	for (i = 0; i < MAX_RESEARCH_TOPICS; i++) {
+		stream.writeUint8(researchTopics[i]);
+	}
+
+	for (i = 0; i < MAX_TECHNOLOGIES; i++) {
+		stream.writeUint8(techs[i]);
+	}
+
+	stream.writeUint32LE(researchProgress);
+
+	stream.seek(45, SEEK_CUR);
+
+	for (i = 0; i < MAX_RESEARCH_AREAS; i++) {
+		stream.writeUint8(hyperTechLevels[i]);
+	}
+
+	stream.seek(253, SEEK_CUR);
+
+	stream.writeUint8(researchTopic);
+	stream.writeUint8(researchItem);
+
+	stream.seek(3, SEEK_CUR);	// FIXME: Unknown data
+
+	for (i = 0; i < MAX_PLAYER_BLUEPRINTS; i++) {
+		blueprints[i].save(stream);
+	}
+
+	selectedBlueprint.save(stream);
+
+	stream.seek(12, SEEK_CUR);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(playerContacts[i]);
+	}
+
+	stream.seek(139, SEEK_CUR);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeSint8(playerRelations[i]);
+	}
+
+	stream.seek(8, SEEK_CUR);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(foreignPolicies[i]);
+	}
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(tradeTreaties[i]);
+	}
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(researchTreaties[i]);
+	}
+
+	stream.seek(608, SEEK_CUR);
+
+	traits.save(stream);
+
+	stream.seek(33, SEEK_CUR);
+
+	for (i = 0; i < MAX_HISTORY_LENGTH; i++) {
+		stream.writeUint8(fleetHistory[i]);
+	}
+
+	for (i = 0; i < MAX_HISTORY_LENGTH; i++) {
+		stream.writeUint8(techHistory[i]);
+	}
+
+	for (i = 0; i < MAX_HISTORY_LENGTH; i++) {
+		stream.writeUint8(populationHistory[i]);
+	}
+
+	for (i = 0; i < MAX_HISTORY_LENGTH; i++) {
+		stream.writeUint8(buildingHistory[i]);
+	}
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(spies[i]);
+	}
+
+	stream.seek(22, SEEK_CUR);
+
+	stream.writeUint8(galaxyCharted);
+
+	stream.seek(51, SEEK_CUR);
+}
+
 int Player::gravityPenalty(unsigned gravity) const {
 	unsigned homegrav;
 
@@ -1366,17 +1901,82 @@ void Star::load(ReadStream &stream) {
 	artifactsGaveApp = stream.readUint8();
 }
 
-void Star::addFleet(Fleet *f) {
-	unsigned status = f->getStatus();
+void Star::save(SeekableWriteStream &stream) const {
+	int i;
+
+	writeString(stream, name, STARS_NAME_SIZE);
+	stream.writeUint16LE(x);
+	stream.writeUint16LE(y);
+	stream.writeUint8(size);
+	stream.writeSint8(owner);
+	stream.writeUint8(pictureType);
+	stream.writeUint8(spectralClass);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(lastPlanetSelected[i]);
+	}
+
+	for (i = 0; i < (MAX_STARS + 7)/8; i++) {
+		stream.writeUint8(blackHoleBlocks[i]);
+	}
+
+	stream.writeUint8(special);
+	stream.writeSint8(wormhole);
+	stream.writeUint8(blockaded);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(blockadedBy[i]);
+	}
+
+	stream.writeUint8(visited);
+	stream.writeUint8(justVisited);
+	stream.writeUint8(ignoreColonyShips);
+	stream.writeUint8(ignoreCombatShips);
+	stream.writeSint8(colonizePlayer);
+	stream.writeUint8(hasColony);
+	stream.writeUint8(hasWarpFieldInterdictor);
+	stream.writeUint8(nextWFIInList);
+	stream.writeUint8(hasTachyon);
+	stream.writeUint8(hasSubspace);
+	stream.writeUint8(hasStargate);
+	stream.writeUint8(hasJumpgate);
+	stream.writeUint8(hasArtemisNet);
+	stream.writeUint8(hasDimensionalPortal);
+	stream.writeUint8(isStagepoint);
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeSint8(officerIndex[i]);
+	}
+
+	for (i = 0; i < MAX_ORBITS; i++) {
+		stream.writeSint16LE(planetIndex[i]);
+	}
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint16LE(relocateShipTo[i]);
+	}
+
+	stream.seek(3, SEEK_CUR);	// Skip unknown data
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		stream.writeUint8(surrenderTo[i]);
+	}
+
+	stream.writeUint8(inNebula);
+	stream.writeUint8(artifactsGaveApp);
+}
+
+void Star::addFleet(BilistNode<Fleet> *node) {
+	unsigned status = node->data->getStatus();
 
 	if (status != ShipState::InOrbit && status != ShipState::LeavingOrbit) {
 		throw std::invalid_argument("Cannot add moving fleet to star");
 	}
 
 	if (status == ShipState::InOrbit) {
-		_lastOrbitingFleet.insert(f);
+		node->insert_before(&_lastOrbitingFleet);
 	} else {
-		_lastLeavingFleet.insert(f);
+		node->insert_before(&_lastLeavingFleet);
 	}
 }
 
@@ -1512,6 +2112,29 @@ void Ship::load(ReadStream &stream) {
 	justBuilt = stream.readUint8();
 }
 
+void Ship::save(SeekableWriteStream &stream) const {
+	design.save(stream);
+	stream.writeUint8(owner);
+	stream.writeUint8(status);
+	stream.writeSint16LE(star);
+	stream.writeUint16LE(x);
+	stream.writeUint16LE(y);
+	stream.writeUint8(groupHasNavigator);
+	stream.writeUint8(warpSpeed);
+	stream.writeUint8(eta);
+	stream.writeUint8(shieldDamage);
+	stream.writeUint8(driveDamage);
+	stream.writeUint8(computerDamage);
+	stream.writeUint8(crewLevel);
+	stream.writeUint16LE(crewExp);
+	stream.writeSint16LE(officer);
+	stream.write(damagedSpecials, (MAX_SHIP_SPECIALS + 7) / 8);
+	stream.writeUint16LE(armorDamage);
+	stream.writeUint16LE(structureDamage);
+	stream.writeUint8(mission);
+	stream.writeUint8(justBuilt);
+}
+
 unsigned Ship::getStarID(void) const {
 	return star - (status <= ShipState::LeavingOrbit ? 500 * status : 0);
 }
@@ -1607,224 +2230,806 @@ void Ship::validate(void) const {
 	}
 }
 
-GameState::GameState(void) {
-	_firstMovingFleet.insert_before(&_lastMovingFleet);
+ValidationErrors::ValidationErrors(void) : _messages(NULL), _count(0),
+	_size(0) {
+
 }
 
-GameState::~GameState(void) {
-	BilistNode<Fleet> *next, *ptr = _firstMovingFleet.next();
+ValidationErrors::~ValidationErrors(void) {
+	clear();
+	delete[] _messages;
+}
 
-	// prevent array scans in removeFleet() called by fleet destructor
-	_firstMovingFleet.unlink();
+void ValidationErrors::add(const char *fmt, ...) {
+	char buf[256], **tmp;
+	va_list args;
 
-	for (; ptr && ptr != &_lastMovingFleet; ptr = next) {
-		next = ptr->next();
-		delete ptr->data;
-		delete ptr;
-	}
-}
+	if (_count >= _size) {
+		unsigned size = _size ? 2 * _size : 16;
 
-Fleet *GameState::findFleet(unsigned owner, unsigned status, unsigned x,
-	unsigned y, unsigned star_id) {
+		tmp = new char*[size];
 
-	BilistNode<Fleet> *node;
-	Fleet *f;
-	Star *dest;
-	unsigned old_star;
+		if (_count) {
+			memcpy(tmp, _messages, _count * sizeof(char*));
+		}
 
-	if (star_id > _starSystemCount) {
-		throw std::out_of_range("Invalid star ID");
+		delete[] _messages;
+		_messages = tmp;
+		_size = size;
 	}
 
-	switch (status) {
-	case ShipState::InOrbit:
-		node = _starSystems[star_id].getOrbitingFleets();
-		dest = NULL;
-		break;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	_messages[_count] = copystr(buf);
+	_count++;
+}
 
-	case ShipState::InTransit:
-		node = _firstMovingFleet.next();
-		dest = _starSystems + star_id;
-		break;
+void ValidationErrors::append(const ValidationErrors &other) {
+	unsigned i;
 
-	case ShipState::LeavingOrbit:
-		old_star = findStar(x, y);
-		node = _starSystems[old_star].getLeavingFleets();
-		dest = _starSystems + star_id;
-		break;
+	for (i = 0; i < other._count; i++) {
+		add("%s", other._messages[i]);
+	}
+}
 
-	default:
-		return NULL;
+void ValidationErrors::clear(void) {
+	unsigned i;
+
+	for (i = 0; i < _count; i++) {
+		delete[] _messages[i];
 	}
 
-	for (; node; node = node->next()) {
-		if (!node->data) {
-			continue;
-		}
+	_count = 0;
+}
 
-		f = node->data;
+unsigned ValidationErrors::count(void) const {
+	return _count;
+}
 
-		if (owner == f->getOwner() && x == f->getX() &&
-			y == f->getY() && dest == f->getDestStar()) {
-			return f;
-		}
+const char *ValidationErrors::message(unsigned id) const {
+	if (id >= _count) {
+		throw std::out_of_range("Invalid validation error ID");
 	}
 
-	return NULL;
+	return _messages[id];
 }
 
-void GameState::createFleets(void) {
+struct ValidateJob {
+	const GameState *game;
+	std::atomic<unsigned> nextTask;
+	std::atomic<int> aborted;
+	ValidationErrors errors[GAMESTATE_VALIDATE_TASKS];
+};
+
+static void reportErrors(const ValidationErrors &errors) {
 	unsigned i;
+
+	if (!errors.count()) {
+		return;
+	}
+
+	for (i = 0; i < errors.count(); i++) {
+		fprintf(stderr, "Validation error: %s\n", errors.message(i));
+	}
+
+	throw std::runtime_error(errors.message(0));
+}
+
+static unsigned starHash(unsigned x, unsigned y) {
+	return ((x << 16 | y) * 2654435761U) >> (32 - STAR_INDEX_BITS);
+}
+
+static unsigned fleetHash(unsigned owner, unsigned status, unsigned x,
+	unsigned y, unsigned star) {
+
+	uint32_t ret = (x << 16 | y) * 2654435761U;
+
+	ret ^= (owner << 16 | status << 8 | star) * 2246822519U;
+	return ret >> (32 - FLEET_INDEX_BITS);
+}
+
+// Storage for a fleet built by createFleets() and its list node
+struct FleetSlot {
+	alignas(Fleet) uint8_t fleet[sizeof(Fleet)];
+	alignas(BilistNode<Fleet>) uint8_t node[sizeof(BilistNode<Fleet>)];
+};
+
+GameState::GameState(void) : _fleetIndexCount(0), _fleetArena(NULL),
+	_fleetArenaCount(0), _saveImage(NULL), _saveImageSize(0),
+	_loadedSections(0), _checksum(0), _starSystemCount(0) {
+	_firstMovingFleet.insert_before(&_lastMovingFleet);
+	memset(_starIndex, -1, sizeof(_starIndex));
+	memset(_fleetIndex, 0, sizeof(_fleetIndex));
+	memset(_colonyStars, 0, sizeof(_colonyStars));
+	memset(_visitedStars, 0, sizeof(_visitedStars));
+	memset(_contactStars, 0, sizeof(_contactStars));
+	memset(_visibleStars, 0, sizeof(_visibleStars));
+}
+
+GameState::~GameState(void) {
+	BilistNode<Fleet> *next, *ptr;
+
+	delete[] _saveImage;
+	releaseFleetArena();
+	ptr = _firstMovingFleet.next();
+
+	// prevent array scans in removeFleet() called by fleet destructor
+	_firstMovingFleet.unlink();
+
+	for (; ptr && ptr != &_lastMovingFleet; ptr = next) {
+		next = ptr->next();
+		delete ptr->data;
+		delete ptr;
+	}
+}
+
+// Sort key which groups ships of the same fleet
+static int64_t fleetKey(const Ship *s) {
+	return (int64_t)s->owner << 48 | (int64_t)s->status << 40 |
+		(int64_t)s->getStarID() << 32 | (int64_t)s->x << 16 | s->y;
+}
+
+// Sort key for ship order within fleet, see Ship::operator<()
+static int64_t fleetOrderKey(const Ship *s) {
+	return (int64_t)s->design.type << 24 |
+		(int64_t)(255 - s->design.size) << 16 |
+		(int64_t)s->design.builder << 8 |
+		(int64_t)(255 - s->design.picture);
+}
+
+void GameState::releaseFleetArena(void) {
+	unsigned i;
+	Fleet *flt;
+	BilistNode<Fleet> *node;
+	FleetSlot *slot;
+
+	// Node destructor unlinks the node unless it was already detached
+	for (i = 0, slot = _fleetArena; i < _fleetArenaCount; i++, slot++) {
+		node = (BilistNode<Fleet>*)slot->node;
+		flt = (Fleet*)slot->fleet;
+		node->setExternalStorage(0);
+		node->~BilistNode<Fleet>();
+		flt->setExternalStorage(0);
+		flt->~Fleet();
+	}
+
+	delete[] _fleetArena;
+	_fleetArena = NULL;
+	_fleetArenaCount = 0;
+}
+
+void GameState::createFleets(void) {
+	unsigned i, j, count, fleets, flagship;
 	Ship *ptr;
 	Fleet *flt;
+	BilistNode<Fleet> *node;
+	FleetSlot *slot;
+	SortKey<unsigned> *ships;
 
-	for (i = 0, ptr = _ships; i < _shipCount; i++, ptr++) {
-		if (!ptr->isActive()) {
-			continue;
+	if (_fleetArena) {
+		throw std::logic_error("Fleets were already created");
+	}
+
+	ships = new SortKey<unsigned>[MAX_SHIPS];
+
+	try {
+		for (i = 0, count = 0, ptr = _ships; i < _shipCount;
+			i++, ptr++) {
+
+			if (!ptr->isActive()) {
+				continue;
+			}
+
+			if (ptr->getStarID() > _starSystemCount) {
+				throw std::out_of_range("Invalid star ID");
+			}
+
+			ships[count].key = fleetOrderKey(ptr);
+			ships[count++].item = i;
+		}
+
+		// Both sorts are stable so ships in each fleet end up in
+		// fleet order and then by ship ID
+		sortByKey(ships, count);
+
+		for (i = 0; i < count; i++) {
+			ships[i].key = fleetKey(_ships + ships[i].item);
+		}
+
+		sortByKey(ships, count);
+
+		for (i = 0, fleets = 0; i < count; i++) {
+			fleets += !i || ships[i].key != ships[i - 1].key;
 		}
 
-		flt = findFleet(ptr->owner, ptr->status, ptr->x, ptr->y,
-			ptr->getStarID());
+		_fleetArena = new FleetSlot[fleets];
 
-		if (flt) {
-			flt->addShip(i);
+		for (i = 0; i < count; i = j) {
+			flagship = ships[i].item;
+
+			for (j = i; j < count && ships[j].key == ships[i].key;
+				j++) {
+				_fleetShips[j] = ships[j].item;
+				flagship = MIN(flagship, ships[j].item);
+			}
+
+			slot = _fleetArena + _fleetArenaCount;
+			flt = ::new(slot->fleet) Fleet(this, flagship,
+				_fleetShips + i, j - i);
+			node = ::new(slot->node) BilistNode<Fleet>;
+			node->data = flt;
+			flt->setExternalStorage(1);
+			node->setExternalStorage(1);
+			_fleetArenaCount++;
+			addFleet(node);
+		}
+	} catch (...) {
+		delete[] ships;
+		throw;
+	}
+
+	delete[] ships;
+}
+
+unsigned GameState::fleetIndexSlot(unsigned owner, unsigned status,
+	unsigned x, unsigned y, unsigned star_id) const {
+
+	unsigned pos, mask = (1 << FLEET_INDEX_BITS) - 1;
+	const Star *star;
+	const Fleet *f;
+
+	// Ships leaving orbit may use star ID equal to star count, see
+	// validateShips()
+	if (star_id > _starSystemCount) {
+		throw std::out_of_range("Invalid star ID");
+	}
+
+	star = _starSystems + star_id;
+	pos = fleetHash(owner, status, x, y, star_id);
+
+	for (; _fleetIndex[pos]; pos = (pos + 1) & mask) {
+		f = _fleetIndex[pos];
+
+		if (owner != f->getOwner() || status != f->getStatus() ||
+			x != f->getX() || y != f->getY()) {
 			continue;
 		}
 
-		flt = new Fleet(this, i);
+		if (status == ShipState::InOrbit ? f->getOrbitedStar() == star :
+			f->getDestStar() == star) {
+			break;
+		}
+	}
 
-		try {
-			addFleet(flt);
-		} catch (...) {
-			delete flt;
-			throw;
+	return pos;
+}
+
+unsigned GameState::fleetIndexHash(const Fleet *flt) const {
+	const Star *star;
+
+	star = flt->getStatus() == ShipState::InOrbit ?
+		flt->getOrbitedStar() : flt->getDestStar();
+	return fleetHash(flt->getOwner(), flt->getStatus(), flt->getX(),
+		flt->getY(), star - _starSystems);
+}
+
+void GameState::indexFleet(Fleet *flt) {
+	unsigned pos, mask = (1 << FLEET_INDEX_BITS) - 1;
+
+	if (2 * _fleetIndexCount >= (1 << FLEET_INDEX_BITS)) {
+		throw std::length_error("Too many fleets");
+	}
+
+	for (pos = fleetIndexHash(flt); _fleetIndex[pos];
+		pos = (pos + 1) & mask);
+
+	_fleetIndex[pos] = flt;
+	_fleetIndexCount++;
+}
+
+void GameState::unindexFleet(const Fleet *flt) {
+	unsigned pos, next, home, mask = (1 << FLEET_INDEX_BITS) - 1;
+
+	for (pos = fleetIndexHash(flt); _fleetIndex[pos] != flt;
+		pos = (pos + 1) & mask) {
+		if (!_fleetIndex[pos]) {
+			return;
+		}
+	}
+
+	// Move later entries of the probe chain into the gap unless their
+	// home slot lies between the gap and their current slot
+	for (next = (pos + 1) & mask; _fleetIndex[next];
+		next = (next + 1) & mask) {
+		home = fleetIndexHash(_fleetIndex[next]);
+
+		if (((next - home) & mask) >= ((next - pos) & mask)) {
+			_fleetIndex[pos] = _fleetIndex[next];
+			pos = next;
 		}
 	}
+
+	_fleetIndex[pos] = NULL;
+	_fleetIndexCount--;
 }
 
-void GameState::addFleet(Fleet *flt) {
-	if (flt->getStatus() != ShipState::InTransit) {
-		flt->getOrbitedStar()->addFleet(flt);
-		return;
+void GameState::addFleet(BilistNode<Fleet> *node) {
+	Fleet *flt = node->data;
+
+	indexFleet(flt);
+
+	try {
+		if (flt->getStatus() != ShipState::InTransit) {
+			flt->getOrbitedStar()->addFleet(node);
+		} else {
+			node->insert_before(&_lastMovingFleet);
+		}
+	} catch (...) {
+		unindexFleet(flt);
+		throw;
 	}
+}
 
-	_lastMovingFleet.insert(flt);
+void GameState::addFleet(Fleet *flt) {
+	BilistNode<Fleet> *node = new BilistNode<Fleet>;
+
+	node->data = flt;
+
+	try {
+		addFleet(node);
+	} catch (...) {
+		delete node;
+		throw;
+	}
 }
 
 void GameState::removeFleet(Fleet *flt) {
-	BilistNode<Fleet> *ptr = _firstMovingFleet.next();
+	BilistNode<Fleet> *ptr;
+	FleetSlot *slot;
+	Star *star;
 
-	for (; ptr && ptr != &_lastMovingFleet; ptr = ptr->next()) {
-		if (ptr->data && ptr->data == flt) {
-			ptr->discard();
+	if (flt->getStatus() == ShipState::InTransit) {
+		ptr = _firstMovingFleet.next();
+	} else {
+		star = flt->getOrbitedStar();
+
+		if (!star) {
 			return;
 		}
+
+		ptr = flt->getStatus() == ShipState::InOrbit ?
+			star->getOrbitingFleets() : star->getLeavingFleets();
 	}
+
+	// End of list is marked by sentinel node without data
+	for (; ptr && ptr->data; ptr = ptr->next()) {
+		if (ptr->data != flt) {
+			continue;
+		}
+
+		unindexFleet(flt);
+		slot = _fleetArena;
+
+		// Arena nodes stay allocated until GameState is destroyed
+		if (slot && (void*)ptr >= (void*)slot &&
+			(void*)ptr < (void*)(slot + _fleetArenaCount)) {
+			ptr->detach();
+		} else {
+			ptr->discard();
+		}
+
+		return;
+	}
+}
+
+void GameState::loadImage(SeekableReadStream &stream) {
+	size_t size;
+	uint8_t *image;
+
+	size = stream.size();
+	image = new uint8_t[size];
+	stream.seek(0, SEEK_SET);
+
+	if (stream.read(image, size) != size) {
+		delete[] image;
+		throw std::runtime_error("Cannot read savegame file");
+	}
+
+	delete[] _saveImage;
+	_saveImage = image;
+	_saveImageSize = size;
+	_loadedSections = 0;
+	_checksum = imageChecksum(image, size);
 }
 
-void GameState::load(SeekableReadStream &stream) {
+void GameState::loadSection(unsigned section) {
+	long offset, size;
 	int i;
 
-	// FIXME: get rid of seeks
-	_gameConfig.load(stream);
-	stream.seek(0x31be4, SEEK_SET);
-	_galaxy.load(stream);
-	stream.seek(COLONY_COUNT_OFFSET, SEEK_SET);
-	_colonyCount = stream.readUint16LE();
+	switch (section) {
+	case GAMESTATE_SECTION_CONFIG:
+		offset = CONFIG_OFFSET;
+		size = CONFIG_SIZE;
+		break;
+
+	case GAMESTATE_SECTION_GALAXY:
+		offset = GALAXY_OFFSET;
+		size = GALAXY_SIZE;
+		break;
+
+	case GAMESTATE_SECTION_COLONIES:
+		offset = COLONY_COUNT_OFFSET;
+		size = 2 + MAX_COLONIES * COLONY_RECORD_SIZE;
+		break;
+
+	case GAMESTATE_SECTION_PLANETS:
+		offset = PLANET_COUNT_OFFSET;
+		size = 2 + MAX_PLANETS * PLANET_RECORD_SIZE;
+		break;
 
-	for (i = 0; i < MAX_COLONIES; i++) {
-		_colonies[i].load(stream);
+	case GAMESTATE_SECTION_STARS:
+		offset = STAR_COUNT_OFFSET;
+		size = 2 + MAX_STARS * STAR_RECORD_SIZE;
+		break;
+
+	case GAMESTATE_SECTION_LEADERS:
+		offset = LEADER_OFFSET;
+		size = LEADER_COUNT * LEADER_RECORD_SIZE;
+		break;
+
+	case GAMESTATE_SECTION_PLAYERS:
+		offset = PLAYER_COUNT_OFFSET;
+		size = 2 + MAX_PLAYERS * PLAYER_RECORD_SIZE;
+		break;
+
+	case GAMESTATE_SECTION_SHIPS:
+		offset = SHIP_COUNT_OFFSET;
+		size = 2 + MAX_SHIPS * SHIP_RECORD_SIZE;
+		break;
+
+	default:
+		throw std::invalid_argument("Invalid savegame section");
 	}
 
-	_planetCount = stream.readUint16LE();
+	if (!_saveImage) {
+		throw std::logic_error("Savegame image not loaded");
+	}
 
-	for (i = 0; i < MAX_PLANETS; i++) {
-		_planets[i].load(stream);
+	if ((size_t)(offset + size) > _saveImageSize) {
+		throw std::runtime_error("Savegame file is truncated");
 	}
 
-	_starSystemCount = stream.readUint16LE();
+	MemoryReadStream stream(_saveImage + offset, size);
+
+	switch (section) {
+	case GAMESTATE_SECTION_CONFIG:
+		_gameConfig.load(stream);
+		break;
+
+	case GAMESTATE_SECTION_GALAXY:
+		_galaxy.load(stream);
+		break;
+
+	case GAMESTATE_SECTION_COLONIES:
+		_colonyCount = stream.readUint16LE();
+
+		for (i = 0; i < MAX_COLONIES; i++) {
+			_colonies[i].load(stream);
+		}
+
+		break;
+
+	case GAMESTATE_SECTION_PLANETS:
+		_planetCount = stream.readUint16LE();
+
+		for (i = 0; i < MAX_PLANETS; i++) {
+			_planets[i].load(stream);
+		}
+
+		break;
+
+	case GAMESTATE_SECTION_STARS:
+		_starSystemCount = stream.readUint16LE();
+
+		for (i = 0; i < MAX_STARS; i++) {
+			_starSystems[i].load(stream);
+		}
+
+		break;
 
-	for (i = 0; i < MAX_STARS; i++) {
-		_starSystems[i].load(stream);
+	case GAMESTATE_SECTION_LEADERS:
+		for (i = 0; i < LEADER_COUNT; i++) {
+			_leaders[i].load(stream);
+		}
+
+		break;
+
+	case GAMESTATE_SECTION_PLAYERS:
+		_playerCount = stream.readUint16LE();
+
+		for (i = 0; i < MAX_PLAYERS; i++) {
+			_players[i].load(stream);
+		}
+
+		break;
+
+	case GAMESTATE_SECTION_SHIPS:
+		_shipCount = stream.readUint16LE();
+
+		for (i = 0; i < MAX_SHIPS; i++) {
+			_ships[i].load(stream);
+		}
+
+		break;
 	}
 
-	for (i = 0; i < LEADER_COUNT; i++) {
-		_leaders[i].load(stream);
+	if (stream.pos() != size) {
+		throw std::logic_error("Savegame section size mismatch");
 	}
 
-	_playerCount = stream.readUint16LE();
+	_loadedSections |= section;
+}
 
-	for (i = 0; i < MAX_PLAYERS; i++) {
-		_players[i].load(stream);
+void GameState::initLoadedState(int level, unsigned threads) {
+	ValidationErrors errors;
+
+	requireSections(GAMESTATE_SECTION_ALL);
+	validate(level, &errors, threads);
+	reportErrors(errors);
+	buildStarIndex();
+	updateStarKnowledge();
+	createFleets();
+}
+
+void GameState::load(SeekableReadStream &stream, int level,
+	unsigned threads) {
+
+	PROFILE_SCOPE("GameState::load");
+
+	loadImage(stream);
+	initLoadedState(level == GAMESTATE_VALIDATE_TRUSTED ?
+		GAMESTATE_VALIDATE_FULL : level, threads);
+}
+
+void GameState::load(const char *filename, int level, unsigned threads) {
+	uint64_t sum = 0;
+	File fr;
+	PROFILE_SCOPE("GameState::load");
+
+	if (!fr.open(filename)) {
+		throw std::runtime_error("Cannot open savegame file");
 	}
 
-	_shipCount = stream.readUint16LE();
+	if (level == GAMESTATE_VALIDATE_TRUSTED) {
+		sum = readSaveChecksum(filename);
+	}
+
+	loadImage(fr);
 
-	for (i = 0; i < MAX_SHIPS; i++) {
-		_ships[i].load(stream);
+	if (level == GAMESTATE_VALIDATE_TRUSTED) {
+		level = sum && sum == _checksum ? GAMESTATE_VALIDATE_FAST :
+			GAMESTATE_VALIDATE_FULL;
 	}
 
-	validate();
-	createFleets();
+	initLoadedState(level, threads);
 }
 
-void GameState::load(const char *filename) {
+void GameState::loadLazy(SeekableReadStream &stream) {
+	PROFILE_SCOPE("GameState::loadLazy");
+
+	loadImage(stream);
+	requireSections(GAMESTATE_SECTION_CONFIG);
+}
+
+void GameState::loadLazy(const char *filename) {
 	File fr;
 
 	if (!fr.open(filename)) {
 		throw std::runtime_error("Cannot open savegame file");
 	}
 
-	load(fr);
+	loadLazy(fr);
 }
 
-void GameState::validate(void) const {
-	int i, j, tmp;
+void GameState::requireSections(unsigned sections) {
+	unsigned section;
 
-	if (_colonyCount > MAX_COLONIES) {
-		throw std::out_of_range("Invalid colony count");
+	sections &= ~_loadedSections;
+
+	for (section = 1; sections; section <<= 1) {
+		if (sections & section) {
+			loadSection(section);
+			sections &= ~section;
+		}
 	}
+}
 
-	if (_planetCount > MAX_PLANETS) {
-		throw std::out_of_range("Invalid planet count");
+unsigned GameState::loadedSections(void) const {
+	return _loadedSections;
+}
+
+void GameState::save(SeekableWriteStream &stream) const {
+	int i;
+	PROFILE_SCOPE("GameState::save");
+
+	if (!_saveImage) {
+		throw std::runtime_error("Cannot save game without savegame image");
 	}
 
-	if (_starSystemCount > MAX_STARS) {
-		throw std::out_of_range("Invalid star system count");
+	// Unknown data is preserved from the loaded savegame
+	stream.seek(0, SEEK_SET);
+	stream.write(_saveImage, _saveImageSize);
+	stream.seek(0, SEEK_SET);
+
+	// Sections which were never decoded are still intact in the image
+	if (_loadedSections & GAMESTATE_SECTION_CONFIG) {
+		stream.seek(CONFIG_OFFSET, SEEK_SET);
+		_gameConfig.save(stream);
 	}
 
-	if (_playerCount > MAX_PLAYERS) {
-		throw std::out_of_range("Invalid player count");
+	if (_loadedSections & GAMESTATE_SECTION_GALAXY) {
+		stream.seek(GALAXY_OFFSET, SEEK_SET);
+		_galaxy.save(stream);
 	}
 
-	if (_shipCount > MAX_SHIPS) {
-		throw std::out_of_range("Invalid star system count");
+	if (_loadedSections & GAMESTATE_SECTION_COLONIES) {
+		stream.seek(COLONY_COUNT_OFFSET, SEEK_SET);
+		stream.writeUint16LE(_colonyCount);
+
+		for (i = 0; i < MAX_COLONIES; i++) {
+			_colonies[i].save(stream);
+		}
+	}
+
+	if (_loadedSections & GAMESTATE_SECTION_PLANETS) {
+		stream.seek(PLANET_COUNT_OFFSET, SEEK_SET);
+		stream.writeUint16LE(_planetCount);
+
+		for (i = 0; i < MAX_PLANETS; i++) {
+			_planets[i].save(stream);
+		}
+	}
+
+	if (_loadedSections & GAMESTATE_SECTION_STARS) {
+		stream.seek(STAR_COUNT_OFFSET, SEEK_SET);
+		stream.writeUint16LE(_starSystemCount);
+
+		for (i = 0; i < MAX_STARS; i++) {
+			_starSystems[i].save(stream);
+		}
+	}
+
+	if (_loadedSections & GAMESTATE_SECTION_LEADERS) {
+		stream.seek(LEADER_OFFSET, SEEK_SET);
+
+		for (i = 0; i < LEADER_COUNT; i++) {
+			_leaders[i].save(stream);
+		}
+	}
+
+	if (_loadedSections & GAMESTATE_SECTION_PLAYERS) {
+		stream.seek(PLAYER_COUNT_OFFSET, SEEK_SET);
+		stream.writeUint16LE(_playerCount);
+
+		for (i = 0; i < MAX_PLAYERS; i++) {
+			_players[i].save(stream);
+		}
+	}
+
+	if (_loadedSections & GAMESTATE_SECTION_SHIPS) {
+		stream.seek(SHIP_COUNT_OFFSET, SEEK_SET);
+		stream.writeUint16LE(_shipCount);
+
+		for (i = 0; i < MAX_SHIPS; i++) {
+			_ships[i].save(stream);
+		}
+	}
+}
+
+void GameState::save(const char *filename) const {
+	MemoryWriteStream data(_saveImageSize);
+
+	save(data);
+	writeSaveFile(filename, data);
+}
+
+void GameState::autosave(const char *filename) const {
+	MemoryWriteStream *data;
+	char *name;
+
+	data = new MemoryWriteStream(_saveImageSize);
+
+	try {
+		save(*data);
+		name = copystr(filename);
+	} catch (...) {
+		delete data;
+		throw;
+	}
+
+	AutoMutex lock(autosave_mutex);
+
+	// Replace older autosave which has not been written yet
+	if (autosave_pending.data) {
+		delete autosave_pending.data;
+		delete[] autosave_pending.filename;
+	}
+
+	autosave_pending.data = data;
+	autosave_pending.filename = name;
+
+	if (autosave_active) {
+		return;
+	}
+
+	// Previous worker has finished or was never started
+	autosave_thread.join();
+
+	try {
+		autosave_thread.start(autosaveWorker, NULL, "autosave");
+	} catch (...) {
+		autosave_pending.data = NULL;
+		autosave_pending.filename = NULL;
+		delete data;
+		delete[] name;
+		throw;
 	}
 
-	_galaxy.validate();
+	autosave_active = 1;
+}
+
+int GameState::validateThread(void *arg) {
+	static void (GameState::*const tasks[GAMESTATE_VALIDATE_TASKS])(
+		ValidationErrors &errors) const = {
+		&GameState::validateStars,
+		&GameState::validateLeaders,
+		&GameState::validatePlayers,
+		&GameState::validatePlanets,
+		&GameState::validateColonies,
+		&GameState::validateShips
+	};
+	ValidateJob *job = (ValidateJob*)arg;
+	unsigned i;
+
+	while ((i = job->nextTask++) < GAMESTATE_VALIDATE_TASKS) {
+		try {
+			(job->game->*tasks[i])(job->errors[i]);
+		} catch (...) {
+			job->aborted = 1;
+		}
+	}
+
+	return 0;
+}
+
+void GameState::validateStars(ValidationErrors &errors) const {
+	int i, j;
 
-	// Validate star systems
 	for (i = 0; i < _starSystemCount; i++) {
 		const Star *ptr = _starSystems + i;
 
-		ptr->validate();
+		try {
+			ptr->validate();
+		} catch (std::exception &e) {
+			errors.add("Star %d: %s", i, e.what());
+			continue;
+		}
 
 		if (ptr->x >= _galaxy.width || ptr->y >= _galaxy.height) {
-			throw std::out_of_range("Star outside galaxy area");
+			errors.add("Star %d: Star outside galaxy area", i);
 		}
 
 		if (ptr->owner >= (int)_playerCount ||
 			(ptr->owner >= 0 && _players[ptr->owner].eliminated)) {
-			throw std::out_of_range("Invalid star owner");
+			errors.add("Star %d: Invalid star owner", i);
 		}
 
 		if (ptr->wormhole >= _starSystemCount) {
-			throw std::out_of_range("Invalid wormhole index");
-		}
-
-		if (ptr->wormhole >= 0 &&
+			errors.add("Star %d: Invalid wormhole index", i);
+		} else if (ptr->wormhole >= 0 &&
 			_starSystems[ptr->wormhole].wormhole != i) {
-			throw std::logic_error("One-way wormholes not allowed");
+			errors.add("Star %d: One-way wormholes not allowed", i);
 		}
 
 		for (j = 0; j < MAX_ORBITS; j++) {
@@ -1833,36 +3038,58 @@ void GameState::validate(void) const {
 			if (ptr->planetIndex[j] < 0) {
 				continue;
 			} else if (ptr->planetIndex[j] >= _planetCount) {
-				throw std::out_of_range("Star references invalid planet ID");
+				errors.add("Star %d: Star references invalid planet ID",
+					i);
+				continue;
 			}
 
 			planet = _planets + ptr->planetIndex[j];
 
 			if (planet->star != i) {
-				throw std::logic_error("Planet referenced by wrong star");
+				errors.add("Star %d: Planet referenced by wrong star",
+					i);
 			}
 
 			if (planet->orbit != j) {
-				throw std::logic_error("Planet is on wrong orbit");
+				errors.add("Star %d: Planet is on wrong orbit", i);
 			}
 		}
 	}
+}
+
+void GameState::validateLeaders(ValidationErrors &errors) const {
+	int i;
 
 	for (i = 0; i < LEADER_COUNT; i++) {
-		_leaders[i].validate();
+		try {
+			_leaders[i].validate();
+		} catch (std::exception &e) {
+			errors.add("Leader %d: %s", i, e.what());
+			continue;
+		}
 
 		if (_leaders[i].playerIndex >= _playerCount) {
-			throw std::out_of_range("Leader is at invalid player");
+			errors.add("Leader %d: Leader is at invalid player", i);
 		}
 	}
+}
+
+void GameState::validatePlayers(ValidationErrors &errors) const {
+	int i, j;
 
-	// Validate players
 	for (i = 0; i < _playerCount; i++) {
-		_players[i].validate();
+		try {
+			_players[i].validate();
+		} catch (std::exception &e) {
+			errors.add("Player %d: %s", i, e.what());
+			continue;
+		}
 
 		for (j = 0; j < MAX_PLAYER_BLUEPRINTS; j++) {
 			if (_players[i].blueprints[j].builder != i) {
-				throw std::runtime_error("Wrong blueprint builder");
+				errors.add("Player %d: Wrong blueprint builder",
+					i);
+				break;
 			}
 		}
 
@@ -1879,7 +3106,9 @@ void GameState::validate(void) const {
 		for (j = i + 1; j < _playerCount; j++) {
 			if (_players[i].playerContacts[j] !=
 				_players[j].playerContacts[i]) {
-				throw std::runtime_error("Player contact mismatch");
+				errors.add("Player %d: Player contact mismatch",
+					i);
+				continue;
 			}
 
 			if (!_players[i].playerContacts[j]) {
@@ -1888,51 +3117,66 @@ void GameState::validate(void) const {
 
 			if (_players[i].playerRelations[j] !=
 				_players[j].playerRelations[i]) {
-				throw std::runtime_error("Player relations mismatch");
+				errors.add("Player %d: Player relations mismatch",
+					i);
 			}
 
 			if (_players[i].foreignPolicies[j] !=
 				_players[j].foreignPolicies[i]) {
-				throw std::runtime_error("Player diplomatic state mismatch");
+				errors.add("Player %d: Player diplomatic state mismatch",
+					i);
 			}
 
 			if (_players[i].tradeTreaties[j] !=
 				_players[j].tradeTreaties[i]) {
-				throw std::runtime_error("Player trade treaty mismatch");
+				errors.add("Player %d: Player trade treaty mismatch",
+					i);
 			}
 
 			if (_players[i].researchTreaties[j] !=
 				_players[j].researchTreaties[i]) {
-				throw std::runtime_error("Player research treaty mismatch");
+				errors.add("Player %d: Player research treaty mismatch",
+					i);
 			}
 		}
 	}
+}
+
+void GameState::validatePlanets(ValidationErrors &errors) const {
+	int i;
 
 	for (i = 0; i < _planetCount; i++) {
 		const Planet *ptr = _planets + i;
 
-		ptr->validate();
-
-		if (ptr->star >= _starSystemCount) {
-			throw std::out_of_range("Planet has invalid star ID");
+		try {
+			ptr->validate();
+		} catch (std::exception &e) {
+			errors.add("Planet %d: %s", i, e.what());
+			continue;
 		}
 
-		if (_starSystems[ptr->star].planetIndex[ptr->orbit] != i) {
+		if (ptr->star >= _starSystemCount) {
+			errors.add("Planet %d: Planet has invalid star ID", i);
+		} else if (_starSystems[ptr->star].planetIndex[ptr->orbit] !=
+			i) {
 			// Yes, this can happen in the original game
 			fprintf(stderr, "Warning: Planet %d not referenced by parent star\n",
 				i);
 		}
 
 		if (ptr->colony >= _colonyCount) {
-			throw std::out_of_range("Planet has invalid colony ID");
-		}
-
-		if (ptr->colony >= 0 && _colonies[ptr->colony].planet != i) {
-			throw std::logic_error("Colony referenced by wrong planet");
+			errors.add("Planet %d: Planet has invalid colony ID", i);
+		} else if (ptr->colony >= 0 &&
+			_colonies[ptr->colony].planet != i) {
+			errors.add("Planet %d: Colony referenced by wrong planet",
+				i);
 		}
 	}
+}
+
+void GameState::validateColonies(ValidationErrors &errors) const {
+	int i, j, tmp;
 
-	// Validate colonies
 	for (i = 0; i < _colonyCount; i++) {
 		const Colony *ptr = _colonies + i;
 
@@ -1940,25 +3184,34 @@ void GameState::validate(void) const {
 			continue;	// Colony was destroyed, skip
 		}
 
-		ptr->validate();
+		try {
+			ptr->validate();
+		} catch (std::exception &e) {
+			errors.add("Colony %d: %s", i, e.what());
+			continue;
+		}
 
 		if (ptr->owner < 0 || ptr->owner >= _playerCount ||
 			_players[ptr->owner].eliminated) {
-			throw std::logic_error("Colony owned by invalid player");
+			errors.add("Colony %d: Colony owned by invalid player",
+				i);
 		}
 
 		if (ptr->planet >= _planetCount) {
-			throw std::out_of_range("Colony is on invalid planet");
+			errors.add("Colony %d: Colony is on invalid planet", i);
+			continue;
 		}
 
 		if (_planets[ptr->planet].colony != (int)i) {
-			throw std::logic_error("Colony not referenced by parent planet");
+			errors.add("Colony %d: Colony not referenced by parent planet",
+				i);
 		}
 
 		if (ptr->climate != _planets[ptr->planet].climate &&
 			(_planets[ptr->planet].climate != RADIATED ||
 			ptr->climate != BARREN)) {
-			throw std::logic_error("Climate mismatch between planet and colony");
+			errors.add("Colony %d: Climate mismatch between planet and colony",
+				i);
 		}
 
 		for (j = 0; j < ptr->population; j++) {
@@ -1966,16 +3219,20 @@ void GameState::validate(void) const {
 
 			if ((tmp >= _playerCount && tmp < MAX_PLAYERS) ||
 				tmp >= MAX_RACES) {
-				throw std::logic_error("Invalid colonist race");
+				errors.add("Colony %d: Invalid colonist race", i);
 			}
 
 			if (ptr->colonists[j].loyalty >= _playerCount) {
-				throw std::out_of_range("Colonist loyal to invalid player");
+				errors.add("Colony %d: Colonist loyal to invalid player",
+					i);
 			}
 		}
 	}
+}
+
+void GameState::validateShips(ValidationErrors &errors) const {
+	int i, tmp;
 
-	// Validate ships
 	for (i = 0; i < _shipCount; i++) {
 		const Ship *ptr = _ships + i;
 
@@ -1983,10 +3240,15 @@ void GameState::validate(void) const {
 			continue;
 		}
 
-		ptr->validate();
+		try {
+			ptr->validate();
+		} catch (std::exception &e) {
+			errors.add("Ship %d: %s", i, e.what());
+			continue;
+		}
 
 		if (ptr->x >= _galaxy.width || ptr->y >= _galaxy.height) {
-			throw std::out_of_range("Ship outside galaxy area");
+			errors.add("Ship %d: Ship outside galaxy area", i);
 		}
 
 		tmp = ptr->getStarID();
@@ -1995,7 +3257,7 @@ void GameState::validate(void) const {
 			(ptr->status != ShipState::LeavingOrbit ||
 			tmp != _starSystemCount)) {
 
-			throw std::out_of_range("Ship has invalid star ID");
+			errors.add("Ship %d: Ship has invalid star ID", i);
 		}
 
 		if (ptr->design.type == ShipType::COLONY_SHIP ||
@@ -2005,115 +3267,406 @@ void GameState::validate(void) const {
 			tmp = ptr->design.weapons[0].type;
 
 			if (tmp >= _planetCount) {
-				throw std::out_of_range(
-					"Invalid destination planet");
-			}
-
-			if ((ptr->status == ShipState::LeavingOrbit ||
+				errors.add("Ship %d: Invalid destination planet",
+					i);
+			} else if ((ptr->status == ShipState::LeavingOrbit ||
 				ptr->status == ShipState::InTransit) &&
 				tmp >= 0 &&
 				_planets[tmp].star != ptr->getStarID()) {
 
-				throw std::out_of_range(
-					"Invalid destination planet");
+				errors.add("Ship %d: Invalid destination planet",
+					i);
 			}
 		}
 	}
 }
 
-void GameState::setActivePlayer(unsigned player_id) {
-	unsigned i, j;
-	Player *pptr;
-	Star *sptr;
-
-	if (player_id >= _playerCount) {
+unsigned GameState::validate(int level, ValidationErrors *errors,
+	unsigned threads) const {
+
+	unsigned i, count, started = 0, start;
+	ValidationErrors tmp;
+	ValidationErrors *list = errors ? errors : &tmp;
+	Thread workers[GAMESTATE_VALIDATE_TASKS - 1];
+	ValidateJob job;
+	PROFILE_SCOPE("GameState::validate");
+
+	start = list->count();
+
+	if (_colonyCount > MAX_COLONIES) {
+		list->add("Invalid colony count");
+	}
+
+	if (_planetCount > MAX_PLANETS) {
+		list->add("Invalid planet count");
+	}
+
+	if (_starSystemCount > MAX_STARS) {
+		list->add("Invalid star system count");
+	}
+
+	if (_playerCount > MAX_PLAYERS) {
+		list->add("Invalid player count");
+	}
+
+	if (_shipCount > MAX_SHIPS) {
+		list->add("Invalid ship count");
+	}
+
+	try {
+		_galaxy.validate();
+	} catch (std::exception &e) {
+		list->add("Galaxy: %s", e.what());
+	}
+
+	// Deep checks would index out of bounds with invalid counts
+	if (list->count() > start || level == GAMESTATE_VALIDATE_FAST) {
+		return list->count() - start;
+	}
+
+	// Entity types are independent, check them in parallel and keep
+	// the error order stable
+	job.game = this;
+	job.nextTask = 0;
+	job.aborted = 0;
+	count = MIN(threads, GAMESTATE_VALIDATE_TASKS);
+
+	for (i = 0; i + 1 < count; i++) {
+		try {
+			workers[i].start(validateThread, &job, "validate");
+		} catch (...) {
+			// The calling thread will run the remaining tasks
+			break;
+		}
+
+		started++;
+	}
+
+	validateThread(&job);
+
+	for (i = 0; i < started; i++) {
+		workers[i].join();
+	}
+
+	if (job.aborted) {
+		list->add("Validation aborted");
+	}
+
+	for (i = 0; i < GAMESTATE_VALIDATE_TASKS; i++) {
+		list->append(job.errors[i]);
+	}
+
+	return list->count() - start;
+}
+
+void GameState::validate(void) const {
+	ValidationErrors errors;
+
+	validate(GAMESTATE_VALIDATE_FULL, &errors);
+	reportErrors(errors);
+}
+
+uint64_t GameState::checksum(void) const {
+	return _checksum;
+}
+
+void GameState::setActivePlayer(unsigned player_id) {
+	unsigned i, j;
+	Player *pptr;
+	Star *sptr;
+
+	if (player_id >= _playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	pptr = _players + player_id;
+
+	// update star system ownership cache
+	for (i = 0; i < _starSystemCount; i++) {
+		sptr = _starSystems + i;
+		sptr->owner = -1;
+
+		if (!sptr->hasColony || !isStarExplored(sptr, player_id)) {
+			continue;
+		}
+
+		if (sptr->hasColony & (1 << player_id)) {
+			sptr->owner = player_id;
+			continue;
+		}
+
+		if (!starMaskTest(_visibleStars[player_id], i)) {
+			continue;
+		}
+
+		for (j = 0; j < _playerCount; j++) {
+			if (sptr->hasColony & (1 << j) &&
+				pptr->isPlayerVisible(j)) {
+
+				sptr->owner = j;
+				break;
+			}
+		}
+	}
+}
+
+void GameState::buildStarIndex(void) {
+	unsigned i, pos, mask = (1 << STAR_INDEX_BITS) - 1;
+	const Star *ptr;
+
+	memset(_starIndex, -1, sizeof(_starIndex));
+
+	for (i = 0, ptr = _starSystems; i < _starSystemCount; i++, ptr++) {
+		pos = starHash(ptr->x, ptr->y);
+
+		for (; _starIndex[pos] >= 0; pos = (pos + 1) & mask) {
+			// Keep the first star on duplicate coordinates
+			if (_starSystems[_starIndex[pos]].x == ptr->x &&
+				_starSystems[_starIndex[pos]].y == ptr->y) {
+				break;
+			}
+		}
+
+		if (_starIndex[pos] < 0) {
+			_starIndex[pos] = i;
+		}
+	}
+}
+
+Fleet *GameState::findFleet(unsigned owner, unsigned status, unsigned x,
+	unsigned y, unsigned star_id) {
+
+	return _fleetIndex[fleetIndexSlot(owner, status, x, y, star_id)];
+}
+
+const Fleet *GameState::findFleet(unsigned owner, unsigned status,
+	unsigned x, unsigned y, unsigned star_id) const {
+
+	return _fleetIndex[fleetIndexSlot(owner, status, x, y, star_id)];
+}
+
+unsigned GameState::findStar(int x, int y) const {
+	unsigned pos, mask = (1 << STAR_INDEX_BITS) - 1;
+	const Star *ptr;
+
+	if (x < 0 || y < 0 || x > 0xffff || y > 0xffff) {
+		throw std::runtime_error("No star at given coordinates");
+	}
+
+	pos = starHash(x, y);
+
+	for (; _starIndex[pos] >= 0; pos = (pos + 1) & mask) {
+		ptr = _starSystems + _starIndex[pos];
+
+		if (ptr->x == x && ptr->y == y) {
+			return _starIndex[pos];
+		}
+	}
+
+	throw std::runtime_error("No star at given coordinates");
+}
+
+BilistNode<Fleet> *GameState::getMovingFleets(void) {
+	return _firstMovingFleet.next();
+}
+
+const BilistNode<Fleet> *GameState::getMovingFleets(void) const {
+	return _firstMovingFleet.next();
+}
+
+StarKnowledge GameState::isStarExplored(unsigned star_id,
+	unsigned player_id) const {
+
+	if (star_id >= _starSystemCount) {
+		throw std::out_of_range("Invalid star ID");
+	}
+
+	return isStarExplored(_starSystems + star_id, player_id);
+}
+
+StarKnowledge GameState::isStarExplored(const Star *s,
+	unsigned player_id) const {
+
+	unsigned star_id = s - _starSystems;
+	const Player *p;
+
+	if (player_id >= _playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	if (starMaskTest(_visitedStars[player_id], star_id)) {
+		return STAR_VISITED;
+	}
+
+	p = _players + player_id;
+
+	if (p->galaxyCharted || p->traits.omniscience) {
+		return STAR_CHARTED;
+	}
+
+	if (starMaskTest(_contactStars[player_id], star_id)) {
+		return STAR_NAME_ONLY;
+	}
+
+	return STAR_UNEXPLORED;
+}
+
+void GameState::knownStars(unsigned player_id, StarKnowledge level,
+	uint64_t *mask) const {
+
+	unsigned i;
+	const Player *p;
+
+	if (player_id >= _playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	p = _players + player_id;
+
+	if (level <= STAR_UNEXPLORED || (level <= STAR_CHARTED &&
+		(p->galaxyCharted || p->traits.omniscience))) {
+		memset(mask, 0, STAR_MASK_WORDS * sizeof(uint64_t));
+
+		for (i = 0; i < _starSystemCount; i++) {
+			starMaskSet(mask, i, 1);
+		}
+
+		return;
+	}
+
+	for (i = 0; i < STAR_MASK_WORDS; i++) {
+		mask[i] = _visitedStars[player_id][i];
+
+		if (level <= STAR_NAME_ONLY) {
+			mask[i] |= _contactStars[player_id][i];
+		}
+	}
+}
+
+const uint64_t *GameState::colonyStars(unsigned player_id) const {
+	if (player_id >= MAX_PLAYERS) {
 		throw std::out_of_range("Invalid player ID");
 	}
 
-	pptr = _players + player_id;
+	return _colonyStars[player_id];
+}
 
-	// update star system ownership cache
-	for (i = 0; i < _starSystemCount; i++) {
-		sptr = _starSystems + i;
-		sptr->owner = -1;
+// Recalculate stars of contacted and visible players
+void GameState::updatePlayerKnowledge(unsigned player_id) {
+	unsigned i, j;
+	const Player *p = _players + player_id;
 
-		if (!sptr->hasColony || !isStarExplored(sptr, player_id)) {
-			continue;
-		}
+	memset(_contactStars[player_id], 0, STAR_MASK_WORDS * sizeof(uint64_t));
+	memset(_visibleStars[player_id], 0, STAR_MASK_WORDS * sizeof(uint64_t));
 
-		if (sptr->hasColony & (1 << player_id)) {
-			sptr->owner = player_id;
-			continue;
+	for (i = 0; i < _playerCount; i++) {
+		for (j = 0; p->playerContacts[i] && j < STAR_MASK_WORDS; j++) {
+			_contactStars[player_id][j] |= _colonyStars[i][j];
 		}
 
-		for (j = 0; j < _playerCount; j++) {
-			if (sptr->hasColony & (1 << j) &&
-				pptr->isPlayerVisible(j)) {
-
-				sptr->owner = j;
-				break;
-			}
+		for (j = 0; p->isPlayerVisible(i) && j < STAR_MASK_WORDS; j++) {
+			_visibleStars[player_id][j] |= _colonyStars[i][j];
 		}
 	}
 }
 
-unsigned GameState::findStar(int x, int y) const {
-	unsigned i;
+void GameState::updateStarKnowledge(void) {
+	unsigned i, j;
+	const Star *ptr;
 
-	for (i = 0; i < _starSystemCount; i++) {
-		if (_starSystems[i].x == x && _starSystems[i].y == y) {
-			return i;
+	memset(_colonyStars, 0, sizeof(_colonyStars));
+	memset(_visitedStars, 0, sizeof(_visitedStars));
+
+	for (i = 0, ptr = _starSystems; i < _starSystemCount; i++, ptr++) {
+		for (j = 0; j < MAX_PLAYERS; j++) {
+			starMaskSet(_visitedStars[j], i, ptr->visited & (1 << j));
+			starMaskSet(_colonyStars[j], i, ptr->hasColony & (1 << j));
 		}
 	}
 
-	throw std::runtime_error("No star at given coordinates");
-}
-
-BilistNode<Fleet> *GameState::getMovingFleets(void) {
-	return _firstMovingFleet.next();
-}
-
-const BilistNode<Fleet> *GameState::getMovingFleets(void) const {
-	return _firstMovingFleet.next();
+	for (i = 0; i < _playerCount; i++) {
+		updatePlayerKnowledge(i);
+	}
 }
 
-StarKnowledge GameState::isStarExplored(unsigned star_id,
-	unsigned player_id) const {
-
+void GameState::setStarVisited(unsigned star_id, unsigned player_id) {
 	if (star_id >= _starSystemCount) {
 		throw std::out_of_range("Invalid star ID");
 	}
 
-	return isStarExplored(_starSystems + star_id, player_id);
+	if (player_id >= _playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	_starSystems[star_id].visited |= 1 << player_id;
+	starMaskSet(_visitedStars[player_id], star_id, 1);
 }
 
-StarKnowledge GameState::isStarExplored(const Star *s,
-	unsigned player_id) const {
+void GameState::setStarColony(unsigned star_id, unsigned player_id,
+	int value) {
 
-	unsigned i;
+	unsigned i, j;
+	int contact, visible;
+	Star *ptr;
 	const Player *p;
 
-	if (s->visited & (1 << player_id)) {
-		return STAR_VISITED;
+	if (star_id >= _starSystemCount) {
+		throw std::out_of_range("Invalid star ID");
 	}
 
 	if (player_id >= _playerCount) {
 		throw std::out_of_range("Invalid player ID");
 	}
 
-	p = _players + player_id;
+	ptr = _starSystems + star_id;
 
-	if (p->galaxyCharted || p->traits.omniscience) {
-		return STAR_CHARTED;
+	if (value) {
+		ptr->hasColony |= 1 << player_id;
+	} else {
+		ptr->hasColony &= ~(1 << player_id);
 	}
 
+	starMaskSet(_colonyStars[player_id], star_id, value);
+
+	// Only the bits of this star can change
 	for (i = 0; i < _playerCount; i++) {
-		if (s->hasColony & (1 << i) && p->playerContacts[i]) {
-			return STAR_NAME_ONLY;
+		p = _players + i;
+		contact = visible = 0;
+
+		for (j = 0; j < _playerCount; j++) {
+			if (!(ptr->hasColony & (1 << j))) {
+				continue;
+			}
+
+			contact = contact || p->playerContacts[j];
+			visible = visible || p->isPlayerVisible(j);
 		}
+
+		starMaskSet(_contactStars[i], star_id, contact);
+		starMaskSet(_visibleStars[i], star_id, visible);
 	}
+}
 
-	return STAR_UNEXPLORED;
+void GameState::setPlayerContact(unsigned player1, unsigned player2,
+	int value) {
+
+	if (player1 >= _playerCount || player2 >= _playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	_players[player1].playerContacts[player2] = value ? 1 : 0;
+	_players[player2].playerContacts[player1] = value ? 1 : 0;
+	updatePlayerKnowledge(player1);
+	updatePlayerKnowledge(player2);
+}
+
+void GameState::setGalaxyCharted(unsigned player_id, int value) {
+	if (player_id >= _playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	_players[player_id].galaxyCharted = value ? 1 : 0;
+	updatePlayerKnowledge(player_id);
 }
 
 unsigned GameState::planetClimate(unsigned planet_id) const {
@@ -2244,42 +3797,6 @@ int GameState::shipBeamDefense(const Ship *sptr, int ignoreDamage) const {
 	return ret;
 }
 
-void GameState::sort_ids(unsigned *id_list, unsigned length, int player,
-	gamestate_cmp_func cmp) {
-
-	unsigned plist[3];
-	unsigned tmp, pivot, i, j;
-
-	if (length <= 1) {
-		return;
-	} else if (length < 6) {
-		pivot = id_list[length / 2];
-	} else {
-		plist[0] = id_list[0];
-		plist[1] = id_list[length / 2];
-		plist[2] = id_list[length - 1];
-		sort_ids(plist, 3, player, cmp);
-		pivot = plist[1];
-	}
-
-	for (i = 0, j = length - 1; i <= j; i++, j--) {
-		for (; cmp(this, player, id_list[i], pivot) < 0; i++);
-		for (; cmp(this, player, id_list[j], pivot) > 0; j--);
-
-		if (i > j) {
-			break;
-		}
-
-		tmp = id_list[i];
-		id_list[i] = id_list[j];
-		id_list[j] = tmp;
-	}
-
-	j++;
-	sort_ids(id_list, j, player, cmp);
-	sort_ids(id_list + j, length - j, player, cmp);
-}
-
 void GameState::dump(void) const {
 	fprintf(stdout, "=== Config ===\n");
 	fprintf(stdout, "Version: %d\n", _gameConfig.version);
@@ -2379,8 +3896,49 @@ void GameState::dump(void) const {
 }
 
 Fleet::Fleet(GameState *parent, unsigned flagship) : _parent(parent),
-	_shipCount(0), _maxShips(8), _orbitedStar(-1), _destStar(-1) {
+	_ships(NULL), _shipCount(0), _maxShips(8), _orbitedStar(-1),
+	_destStar(-1), _sharedShips(0) {
+
+	setFlagship(flagship);
+	_ships = new unsigned[_maxShips];
+	_ships[_shipCount++] = flagship;
+	countShip(_parent->_ships + flagship, 1);
+}
+
+Fleet::Fleet(GameState *parent, unsigned flagship, unsigned *ships,
+	size_t count) : _parent(parent), _ships(ships), _shipCount(0),
+	_maxShips(count), _orbitedStar(-1), _destStar(-1), _sharedShips(1) {
+
+	setFlagship(flagship);
+
+	for (_shipCount = 0; _shipCount < count; _shipCount++) {
+		countShip(checkShip(_ships[_shipCount]), 1);
+	}
+}
+
+Fleet::Fleet(const Fleet &other) : _parent(other._parent), _ships(NULL),
+	_shipCount(other._shipCount), _orbitedStar(other._orbitedStar),
+	_destStar(other._destStar), _owner(other._owner),
+	_status(other._status), _x(other._x), _y(other._y),
+	_hasNavigator(other._hasNavigator), _warpSpeed(other._warpSpeed),
+	_eta(other._eta), _sharedShips(0) {
+
+	_maxShips = _shipCount > 8 ? _shipCount : 8;
+	_ships = new unsigned[_maxShips];
+	memcpy(_ships, other._ships, _shipCount * sizeof(unsigned));
+	memcpy(_shipTypeCounts, other._shipTypeCounts,
+		MAX_SHIP_TYPES * sizeof(size_t));
+	memcpy(_combatCounts, other._combatCounts,
+		MAX_COMBAT_SHIP_CLASSES * sizeof(size_t));
+}
+
+Fleet::~Fleet(void) {
+	if (!_sharedShips) {
+		delete[] _ships;
+	}
+}
 
+void Fleet::setFlagship(unsigned flagship) {
 	Ship *fs;
 
 	if (flagship >= _parent->_shipCount ||
@@ -2417,39 +3975,11 @@ Fleet::Fleet(GameState *parent, unsigned flagship) : _parent(parent),
 	_hasNavigator = fs->groupHasNavigator;
 	_warpSpeed = fs->warpSpeed;
 	_eta = fs->eta;
-
-	_ships = new unsigned[_maxShips];
-	_ships[_shipCount++] = flagship;
-	_shipTypeCounts[fs->design.type]++;
-
-	if (fs->design.type == COMBAT_SHIP) {
-		_combatCounts[fs->design.size]++;
-	}
-}
-
-Fleet::Fleet(const Fleet &other) : _parent(other._parent), _ships(NULL),
-	_shipCount(other._shipCount), _orbitedStar(other._orbitedStar),
-	_destStar(other._destStar), _owner(other._owner),
-	_status(other._status), _x(other._x), _y(other._y),
-	_hasNavigator(other._hasNavigator), _warpSpeed(other._warpSpeed),
-	_eta(other._eta) {
-
-	_maxShips = _shipCount > 8 ? _shipCount : 8;
-	_ships = new unsigned[_maxShips];
-	memcpy(_ships, other._ships, _shipCount * sizeof(unsigned));
-	memcpy(_shipTypeCounts, other._shipTypeCounts,
-		MAX_SHIP_TYPES * sizeof(size_t));
-	memcpy(_combatCounts, other._combatCounts,
-		MAX_COMBAT_SHIP_CLASSES * sizeof(size_t));
 }
 
-Fleet::~Fleet(void) {
-	delete[] _ships;
-}
-
-void Fleet::addShip(unsigned ship_id) {
-	Ship *s;
-	int dest, i = 0, j = _shipCount, pos;
+const Ship *Fleet::checkShip(unsigned ship_id) const {
+	const Ship *s;
+	int dest;
 
 	if (ship_id >= _parent->_shipCount) {
 		throw std::out_of_range("Invalid ship ID");
@@ -2468,15 +3998,37 @@ void Fleet::addShip(unsigned ship_id) {
 		throw std::runtime_error("Ship state does not match fleet");
 	}
 
+	return s;
+}
+
+void Fleet::countShip(const Ship *s, int diff) {
+	_shipTypeCounts[s->design.type] += diff;
+
+	if (s->design.type == COMBAT_SHIP) {
+		_combatCounts[s->design.size] += diff;
+	}
+}
+
+void Fleet::addShip(unsigned ship_id) {
+	const Ship *s;
+	int i = 0, j = _shipCount, pos;
+
+	s = checkShip(ship_id);
+
 	if (_shipCount >= _maxShips) {
 		unsigned *tmp;
-		size_t size = 2 * _maxShips;
+		size_t size = MAX(2 * _maxShips, 8);
 
 		tmp = new unsigned[size];
 		memcpy(tmp, _ships, _shipCount * sizeof(unsigned));
-		delete[] _ships;
+
+		if (!_sharedShips) {
+			delete[] _ships;
+		}
+
 		_ships = tmp;
 		_maxShips = size;
+		_sharedShips = 0;
 	}
 
 	while (i < j) {
@@ -2494,13 +4046,8 @@ void Fleet::addShip(unsigned ship_id) {
 	}
 
 	_ships[pos] = ship_id;
-
-	if (s->design.type == COMBAT_SHIP) {
-		_combatCounts[s->design.size]++;
-	}
-
 	_shipCount++;
-	_shipTypeCounts[s->design.type]++;
+	countShip(s, 1);
 	// FIXME: update _hasNavigator, recalculate speed, eta and update ships
 }
 
@@ -2519,11 +4066,7 @@ void Fleet::removeShip(size_t pos) {
 	}
 
 	_shipCount--;
-	_shipTypeCounts[s->design.type]--;
-
-	if (s->design.type == COMBAT_SHIP) {
-		_combatCounts[s->design.size]--;
-	}
+	countShip(s, -1);
 }
 
 Ship *Fleet::getShip(size_t pos) {
@@ -2606,28 +4149,184 @@ uint16_t Fleet::getY(void) const {
 	return _y;
 }
 
-int cmpPlanetClimate(const GameState *game, int player, unsigned a,
-	unsigned b) {
+PlanetTable::PlanetTable(void) : _game(NULL), _player(0), _rowCount(0) {
+
+}
+
+uint8_t PlanetTable::starFlags(unsigned star_id) const {
+	unsigned i;
+	uint8_t ret = 0;
+	const BilistNode<Fleet> *node;
+
+	if (_game->isStarExplored(star_id, _player) >= STAR_CHARTED) {
+		ret |= PLANET_ROW_CHARTED;
+	}
+
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		if (i != _player &&
+			starMaskTest(_game->colonyStars(i), star_id)) {
+			return ret | PLANET_ROW_HOSTILE;
+		}
+	}
+
+	// FIXME: ignore hidden fleets (known but unvisited star)
+	node = _game->_starSystems[star_id].getOrbitingFleets();
+
+	for (; node; node = node->next()) {
+		if (node->data && node->data->getOwner() != _player) {
+			return ret | PLANET_ROW_HOSTILE;
+		}
+	}
+
+	return ret;
+}
+
+void PlanetTable::updateRow(unsigned row, uint8_t starFlags) {
+	unsigned pid = _planet[row];
+	const Planet *ptr = _game->_planets + pid;
+	const Player *player = _game->_players + _player;
+
+	_flags[row] = starFlags;
+	_climate[row] = _game->planetClimate(pid);
+	_minerals[row] = ptr->minerals;
+	_owner[row] = -1;
+	_gravity[row] = 0;
+	_maxPop[row] = 0;
+
+	if (ptr->colony >= 0) {
+		_owner[row] = _game->_colonies[ptr->colony].owner;
+	}
+
+	if (ptr->type == PlanetType::HABITABLE) {
+		_flags[row] |= PLANET_ROW_HABITABLE;
+		_gravity[row] = player->gravityPenalty(ptr->gravity);
+		_maxPop[row] = _game->planetMaxPop(pid, _player);
+	}
+}
+
+void PlanetTable::build(const GameState *game, unsigned player_id) {
+	unsigned i, j;
+	uint8_t flags;
+	const Star *sptr;
+
+	if (player_id >= game->_playerCount) {
+		throw std::out_of_range("Invalid player ID");
+	}
+
+	_game = game;
+	_player = player_id;
+	_rowCount = 0;
+
+	for (i = 0; i < MAX_PLANETS; i++) {
+		_rowIndex[i] = -1;
+	}
+
+	for (i = 0; i < _game->_starSystemCount; i++) {
+		sptr = _game->_starSystems + i;
+		flags = starFlags(i);
+
+		for (j = 0; j < MAX_ORBITS; j++) {
+			if (sptr->planetIndex[j] < 0) {
+				continue;
+			}
+
+			_rowIndex[sptr->planetIndex[j]] = _rowCount;
+			_planet[_rowCount] = sptr->planetIndex[j];
+			updateRow(_rowCount++, flags);
+		}
+	}
+}
+
+unsigned PlanetTable::rowCount(void) const {
+	return _rowCount;
+}
+
+const uint16_t *PlanetTable::planets(void) const {
+	return _planet;
+}
+
+const uint8_t *PlanetTable::flags(void) const {
+	return _flags;
+}
+
+const uint8_t *PlanetTable::climate(void) const {
+	return _climate;
+}
+
+const uint8_t *PlanetTable::minerals(void) const {
+	return _minerals;
+}
+
+const int8_t *PlanetTable::gravity(void) const {
+	return _gravity;
+}
+
+const int8_t *PlanetTable::owner(void) const {
+	return _owner;
+}
 
-	return int(game->planetClimate(b)) - int(game->planetClimate(a));
+const uint16_t *PlanetTable::maxPop(void) const {
+	return _maxPop;
 }
 
-int cmpPlanetMinerals(const GameState *game, int player, unsigned a,
-	unsigned b) {
+int64_t PlanetTable::sortKey(unsigned planet_id, unsigned column) const {
+	int row = planet_id < MAX_PLANETS ? _rowIndex[planet_id] : -1;
+
+	if (row < 0) {
+		throw std::out_of_range("Invalid planet ID");
+	}
+
+	// Negative keys for descending order
+	switch (column) {
+	case PLANET_SORT_CLIMATE:
+		return -int64_t(_climate[row]);
 
-	int mineralsA, mineralsB;
+	case PLANET_SORT_MINERALS:
+		return -int64_t(_minerals[row]);
 
-	mineralsA = game->_planets[a].minerals;
-	mineralsB = game->_planets[b].minerals;
-	return mineralsB - mineralsA;
+	case PLANET_SORT_MAXPOP:
+		return -int64_t(_maxPop[row]);
+
+	default:
+		throw std::invalid_argument("Invalid planet sort column");
+	}
 }
 
-int cmpPlanetMaxPop(const GameState *game, int player, unsigned a,
-	unsigned b) {
+void PlanetTable::sortPlanets(unsigned *id_list, unsigned length,
+	const unsigned *columns, unsigned column_count) const {
+
+	unsigned i, j;
+	SortKey<unsigned> *data;
+
+	if (length <= 1) {
+		return;
+	}
+
+	data = new SortKey<unsigned>[length];
 
-	int popA, popB;
+	for (i = 0; i < length; i++) {
+		data[i].item = id_list[i];
+	}
+
+	// Sort by the last column first. Each pass is stable so planets
+	// tied in one column stay ordered by the columns after it.
+	try {
+		for (j = column_count; j > 0; j--) {
+			for (i = 0; i < length; i++) {
+				data[i].key = sortKey(data[i].item,
+					columns[j - 1]);
+			}
+
+			sortByKey(data, length);
+		}
+	} catch (...) {
+		delete[] data;
+		throw;
+	}
+
+	for (i = 0; i < length; i++) {
+		id_list[i] = data[i].item;
+	}
 
-	popA = game->planetMaxPop(a, player);
-	popB = game->planetMaxPop(b, player);
-	return popB - popA;
+	delete[] data;
 }
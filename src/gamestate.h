@@ -70,6 +70,24 @@
 #define MAX_NEBULAS 4
 #define MAX_SHIPS 500
 
+// Hash table sizes, must be powers of 2 at least twice the item limit
+#define STAR_INDEX_BITS 8
+#define FLEET_INDEX_BITS 10
+
+// Number of 64bit words in star bitmask
+#define STAR_MASK_WORDS ((MAX_STARS + 63) / 64)
+
+// PlanetTable row flags
+#define PLANET_ROW_HABITABLE 0x1
+#define PLANET_ROW_CHARTED 0x2
+#define PLANET_ROW_HOSTILE 0x4
+
+// PlanetTable sort columns
+#define PLANET_SORT_CLIMATE 0
+#define PLANET_SORT_MINERALS 1
+#define PLANET_SORT_MAXPOP 2
+#define PLANET_SORT_COLUMNS 3
+
 #define MAX_POPULATION 42
 #define MAX_RACES (MAX_PLAYERS+2)	// player races + androids + natives
 #define MAX_BUILD_QUEUE 7
@@ -201,6 +219,17 @@ enum StarKnowledge {
 	STAR_VISITED	// full star system knowledge
 };
 
+inline int starMaskTest(const uint64_t *mask, unsigned star_id) {
+	return (mask[star_id / 64] >> (star_id % 64)) & 1;
+}
+
+inline void starMaskSet(uint64_t *mask, unsigned star_id, int value) {
+	uint64_t bit = 1ULL << (star_id % 64);
+
+	mask[star_id / 64] = value ? mask[star_id / 64] | bit :
+		mask[star_id / 64] & ~bit;
+}
+
 enum SpecialType {
 	NO_SPECIAL = 0,
 	BAD_SPECIAL1 = 1,
@@ -657,10 +686,30 @@ enum SpecialDevices {
 extern const unsigned galaxySizeFactors[GALAXY_ZOOM_LEVELS];
 
 class Fleet;
-class GameState;
-
-typedef int (*gamestate_cmp_func)(const GameState *gamestate, int player,
-	unsigned a, unsigned b);
+// Savegame sections which can be decoded separately
+#define GAMESTATE_SECTION_CONFIG 0x01
+#define GAMESTATE_SECTION_GALAXY 0x02
+#define GAMESTATE_SECTION_COLONIES 0x04
+#define GAMESTATE_SECTION_PLANETS 0x08
+#define GAMESTATE_SECTION_STARS 0x10
+#define GAMESTATE_SECTION_LEADERS 0x20
+#define GAMESTATE_SECTION_PLAYERS 0x40
+#define GAMESTATE_SECTION_SHIPS 0x80
+#define GAMESTATE_SECTION_ALL 0xff
+
+// Validation levels. The fast level checks only item counts and galaxy
+// header, the full level also cross-checks all objects. Trusted level runs
+// the fast checks on savegames written by save()/autosave() whose content
+// did not change since, the full checks otherwise. The content checksum is
+// computed on every load but only the trusted level verifies it, against the
+// checksum file written next to the savegame. Savegames from the original
+// game have no checksum to compare with, so the fast level does not check it.
+#define GAMESTATE_VALIDATE_FAST 0
+#define GAMESTATE_VALIDATE_FULL 1
+#define GAMESTATE_VALIDATE_TRUSTED 2
+
+// Number of independent full validation passes, see GameState::validate()
+#define GAMESTATE_VALIDATE_TASKS 6
 
 struct GameConfig {
 	uint32_t version;
@@ -684,6 +733,7 @@ struct GameConfig {
 	GameConfig(void);
 
 	void load(ReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 };
 
 struct Nebula {
@@ -693,6 +743,7 @@ struct Nebula {
 	Nebula(void);
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 
 	void validate(void) const;
 };
@@ -707,6 +758,7 @@ struct Galaxy {
 	Galaxy(void);
 
 	void load(ReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 
 	void validate(void) const;
 };
@@ -721,6 +773,7 @@ struct Colonist {
 	Colonist(void);
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 };
 
 struct Colony {
@@ -819,6 +872,7 @@ struct Colony {
 	Colony(void);
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 
 	void validate(void) const;
 };
@@ -848,6 +902,7 @@ struct Planet {
 	Planet(void);
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 
 	unsigned baseProduction(void) const;
 
@@ -877,6 +932,7 @@ struct Leader {
 	Leader(void);
 
 	void load(ReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 
 	unsigned expLevel(void) const;
 	const char *rank(void) const;
@@ -899,6 +955,7 @@ struct ShipWeapon {
 	uint8_t ammo;
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 
 	unsigned arcID(void) const;
 	const char *arcAbbr(void) const;
@@ -921,6 +978,7 @@ struct ShipDesign {
 	ShipDesign(void);
 
 	void load(ReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 
 	int hasSpecial(unsigned id) const;
 	int hasWorkingSpecial(unsigned id, const uint8_t* specDamage) const;
@@ -977,6 +1035,7 @@ struct RaceTraits {
 	uint8_t poorHomeworld;
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 };
 
 // Maybe we have padding after job field to fill until 32bits
@@ -986,8 +1045,10 @@ struct SettlerInfo {
 	unsigned player;
 	unsigned eta;
 	unsigned job;
+	unsigned unknown;
 
 	void load(ReadStream &stream);
+	void save(WriteStream &stream) const;
 };
 
 struct Player {
@@ -1058,6 +1119,7 @@ struct Player {
 	Player(void);
 
 	void load(SeekableReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 
 	int gravityPenalty(unsigned gravity) const;
 
@@ -1164,8 +1226,10 @@ public:
 	~Star(void);
 
 	void load(ReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 
-	void addFleet(Fleet *f);
+	// Node data must point to the fleet
+	void addFleet(BilistNode<Fleet> *node);
 	BilistNode<Fleet> *getOrbitingFleets(void);
 	BilistNode<Fleet> *getLeavingFleets(void);
 	const BilistNode<Fleet> *getOrbitingFleets(void) const;
@@ -1200,6 +1264,7 @@ struct Ship {
 	bool operator>=(const Ship &other) const;
 
 	void load(ReadStream &stream);
+	void save(SeekableWriteStream &stream) const;
 
 	// _starSystemCount is the special ID of Antaran homeworld
 	unsigned getStarID(void) const;
@@ -1222,19 +1287,92 @@ struct Ship {
 	void validate(void) const;
 };
 
+// Error messages collected by GameState::validate()
+class ValidationErrors {
+private:
+	char **_messages;
+	unsigned _count, _size;
+
+	// Do NOT implement
+	ValidationErrors(const ValidationErrors &other);
+	const ValidationErrors &operator=(const ValidationErrors &other);
+
+public:
+	ValidationErrors(void);
+	~ValidationErrors(void);
+
+	void add(const char *fmt, ...);
+	void append(const ValidationErrors &other);
+	void clear(void);
+
+	unsigned count(void) const;
+	const char *message(unsigned id) const;
+};
+
+struct FleetSlot;
+
 class GameState {
 private:
 	BilistNode<Fleet> _firstMovingFleet, _lastMovingFleet;
+	// Star IDs hashed by coordinates, -1 marks empty slot
+	int8_t _starIndex[1 << STAR_INDEX_BITS];
+	// Fleets hashed by owner, status, position and star, NULL marks
+	// empty slot
+	Fleet *_fleetIndex[1 << FLEET_INDEX_BITS];
+	unsigned _fleetIndexCount;
+	// Fleets built by createFleets() and their list nodes. They are
+	// freed in bulk with GameState, not through GarbageCollector.
+	FleetSlot *_fleetArena;
+	unsigned _fleetArenaCount;
+	// Star bitmasks per player: stars with player's colony, stars visited
+	// by player, stars with colony of a contacted player and stars with
+	// colony of a player visible to given player
+	uint64_t _colonyStars[MAX_PLAYERS][STAR_MASK_WORDS];
+	uint64_t _visitedStars[MAX_PLAYERS][STAR_MASK_WORDS];
+	uint64_t _contactStars[MAX_PLAYERS][STAR_MASK_WORDS];
+	uint64_t _visibleStars[MAX_PLAYERS][STAR_MASK_WORDS];
+	// Ship lists of fleets built by createFleets(), one slice per fleet
+	unsigned _fleetShips[MAX_SHIPS];
+	// Raw copy of the loaded savegame. save() overwrites known fields
+	// and keeps everything else intact.
+	uint8_t *_saveImage;
+	size_t _saveImageSize;
+	// GAMESTATE_SECTION_* flags already decoded from _saveImage
+	unsigned _loadedSections;
+	// Checksum of _saveImage as it was loaded
+	uint64_t _checksum;
 
 	// Do NOT implement
 	GameState(const GameState &other);
 	const GameState &operator=(const GameState &other);
 
 protected:
-	Fleet *findFleet(unsigned owner, unsigned status, unsigned x,
-		unsigned y, unsigned star);
+	void updatePlayerKnowledge(unsigned player_id);
+
 	void createFleets(void);
 
+	void loadImage(SeekableReadStream &stream);
+	void loadSection(unsigned section);
+	// Validate loaded sections and build derived data
+	void initLoadedState(int level, unsigned threads);
+
+	static int validateThread(void *arg);
+	void validateStars(ValidationErrors &errors) const;
+	void validateLeaders(ValidationErrors &errors) const;
+	void validatePlayers(ValidationErrors &errors) const;
+	void validatePlanets(ValidationErrors &errors) const;
+	void validateColonies(ValidationErrors &errors) const;
+	void validateShips(ValidationErrors &errors) const;
+
+	unsigned fleetIndexSlot(unsigned owner, unsigned status, unsigned x,
+		unsigned y, unsigned star_id) const;
+	unsigned fleetIndexHash(const Fleet *flt) const;
+	void indexFleet(Fleet *flt);
+	void unindexFleet(const Fleet *flt);
+	void releaseFleetArena(void);
+
+	// Node data must point to the fleet
+	void addFleet(BilistNode<Fleet> *node);
 	void addFleet(Fleet *flt);
 	void removeFleet(Fleet *flt);
 
@@ -1256,21 +1394,72 @@ public:
 	GameState(void);
 	~GameState(void);
 
-	void load(SeekableReadStream &stream);
-	void load(const char *filename);
+	// Trusted validation level needs the savegame file name, streams
+	// always get full validation in that case. See validate() for the
+	// threads argument.
+	void load(SeekableReadStream &stream,
+		int level = GAMESTATE_VALIDATE_FULL, unsigned threads = 1);
+	void load(const char *filename, int level = GAMESTATE_VALIDATE_FULL,
+		unsigned threads = 1);
+	// Read savegame but decode only the config header. Other sections
+	// must be requested through requireSections() before use. Nothing is
+	// validated and fleets, star index and other derived data are not
+	// built, only for previews and read-only analysis.
+	void loadLazy(SeekableReadStream &stream);
+	void loadLazy(const char *filename);
+	// Decode GAMESTATE_SECTION_* sections which were not decoded yet
+	void requireSections(unsigned sections);
+	unsigned loadedSections(void) const;
+	// Produces byte-identical savegame if nothing changed since load()
+	void save(SeekableWriteStream &stream) const;
+	// Safe save through temporary file, blocks until data is on disk
+	void save(const char *filename) const;
+	// Serialize state in memory and write it to disk in background
+	void autosave(const char *filename) const;
+	// Returns the number of errors found. Errors are appended to the list
+	// if it is not NULL. Full checks run on up to the given number of
+	// threads including the calling one.
+	unsigned validate(int level, ValidationErrors *errors,
+		unsigned threads = 1) const;
+	// Full validation, throws exception if any error was found
 	void validate(void) const;
+	// Checksum of the loaded savegame file, not updated by later changes
+	uint64_t checksum(void) const;
 	void dump(void) const;
 
 	// update cached values which depend on active player
 	void setActivePlayer(unsigned player_id);
 
+	// Must be called after changing star coordinates
+	void buildStarIndex(void);
 	unsigned findStar(int x, int y) const;
 	BilistNode<Fleet> *getMovingFleets(void);
 	const BilistNode<Fleet> *getMovingFleets(void) const;
+	// Find fleet by owner, status and position. Star is the orbited star
+	// for fleets in orbit, destination star otherwise. Returns NULL if
+	// there is no such fleet.
+	Fleet *findFleet(unsigned owner, unsigned status, unsigned x,
+		unsigned y, unsigned star_id);
+	const Fleet *findFleet(unsigned owner, unsigned status, unsigned x,
+		unsigned y, unsigned star_id) const;
 
 	StarKnowledge isStarExplored(unsigned star_id,
 		unsigned player_id) const;
 	StarKnowledge isStarExplored(const Star *s, unsigned player_id) const;
+	// Get bitmask of stars where player has at least given knowledge
+	void knownStars(unsigned player_id, StarKnowledge level,
+		uint64_t *mask) const;
+	// Get bitmask of stars where player has a colony
+	const uint64_t *colonyStars(unsigned player_id) const;
+
+	// Rebuild all star knowledge bitmasks from scratch
+	void updateStarKnowledge(void);
+	// Change star visits, colonies, contacts and galaxy charting. These
+	// keep star knowledge up to date.
+	void setStarVisited(unsigned star_id, unsigned player_id);
+	void setStarColony(unsigned star_id, unsigned player_id, int value);
+	void setPlayerContact(unsigned player1, unsigned player2, int value);
+	void setGalaxyCharted(unsigned player_id, int value);
 
 	unsigned planetClimate(unsigned planet_id) const;
 	unsigned planetMaxPop(unsigned planet_id, unsigned player_id) const;
@@ -1281,9 +1470,6 @@ public:
 	int shipBeamOffense(const Ship *sptr, int ignoreDamage) const;
 	int shipBeamDefense(unsigned ship_id, int ignoreDamage) const;
 	int shipBeamDefense(const Ship *sptr, int ignoreDamage) const;
-
-	void sort_ids(unsigned *id_list, unsigned length, int player,
-		gamestate_cmp_func cmp);
 };
 
 class Fleet : public Recyclable {
@@ -1298,12 +1484,22 @@ private:
 	uint16_t _x, _y;
 	uint8_t _hasNavigator;
 	uint8_t _warpSpeed, _eta;
+	// _ships points into GameState storage, do not free
+	uint8_t _sharedShips;
+
+	void setFlagship(unsigned flagship);
+	const Ship *checkShip(unsigned ship_id) const;
+	void countShip(const Ship *s, int diff);
 
 	// Do NOT implement
 	const Fleet &operator=(const Fleet &other);
 
 public:
 	Fleet(GameState *parent, unsigned flagship);
+	// Fleet from already sorted list of ships. The list must stay valid
+	// for the whole lifetime of the fleet.
+	Fleet(GameState *parent, unsigned flagship, unsigned *ships,
+		size_t count);
 	Fleet(const Fleet &other);
 	~Fleet(void);
 
@@ -1335,10 +1531,55 @@ public:
 	uint16_t getY(void) const;
 };
 
-int cmpPlanetClimate(const GameState *game, int player, unsigned a,
-	unsigned b);
-int cmpPlanetMinerals(const GameState *game, int player, unsigned a,
-	unsigned b);
-int cmpPlanetMaxPop(const GameState *game, int player, unsigned a, unsigned b);
+// Planet attributes as seen by one player, stored as separate columns so that
+// list filters and sorting do not need to chase stars, colonies and fleets.
+// Rows are ordered by star and orbit.
+class PlanetTable {
+private:
+	const GameState *_game;
+	unsigned _player, _rowCount;
+	int16_t _rowIndex[MAX_PLANETS];
+	uint16_t _planet[MAX_PLANETS];
+	uint8_t _flags[MAX_PLANETS];
+	uint8_t _climate[MAX_PLANETS];
+	uint8_t _minerals[MAX_PLANETS];
+	int8_t _gravity[MAX_PLANETS];
+	int8_t _owner[MAX_PLANETS];
+	uint16_t _maxPop[MAX_PLANETS];
+
+	void updateRow(unsigned row, uint8_t starFlags);
+	uint8_t starFlags(unsigned star_id) const;
+	int64_t sortKey(unsigned planet_id, unsigned column) const;
+
+	// Do NOT implement
+	PlanetTable(const PlanetTable &other);
+	const PlanetTable &operator=(const PlanetTable &other);
+
+public:
+	PlanetTable(void);
+
+	// Rebuild the whole table. PlanetsListView builds its table once in
+	// the constructor, game state cannot change while the view is open.
+	void build(const GameState *game, unsigned player_id);
+
+	unsigned rowCount(void) const;
+	const uint16_t *planets(void) const;
+	const uint8_t *flags(void) const;
+	const uint8_t *climate(void) const;
+	const uint8_t *minerals(void) const;
+	// Gravity penalty for the player in percent
+	const int8_t *gravity(void) const;
+	// Colony owner or -1
+	const int8_t *owner(void) const;
+	const uint16_t *maxPop(void) const;
+
+	// Stable sort of planet IDs by list of PLANET_SORT_* columns, best
+	// first. Later columns break ties in earlier ones.
+	void sortPlanets(unsigned *id_list, unsigned length,
+		const unsigned *columns, unsigned column_count) const;
+};
+
+// Wait until background autosave is written to disk
+void finishAutosave(void);
 
 #endif
@@ -23,6 +23,7 @@
 #include "gfx.h"
 #include "lbx.h"
 #include "screen.h"
+#include "profiler.h"
 
 #define FLAG_JUNCTION	0x2000
 #define FLAG_PALETTE	0x1000
@@ -246,6 +247,7 @@ void Image::load(SeekableReadStream &stream, const uint8_t **base_palettes,
 
 	unsigned i, palstart, palsize, framecount;
 	size_t *offsets;
+	PROFILE_SCOPE("Image::load");
 
 	_width = stream.readUint16LE();
 	_height = stream.readUint16LE();
@@ -21,6 +21,7 @@
 #include <stdexcept>
 #include "lbx.h"
 #include "screen.h"
+#include "profiler.h"
 #include "gui.h"
 
 #define WSTATE_IDLE 0
@@ -1158,6 +1159,7 @@ void WidgetContainer::leaveCurrentWidget(int x, int y, unsigned buttons) {
 
 void WidgetContainer::redrawWidgets(int x, int y, unsigned curtick) {
 	size_t i;
+	PROFILE_SCOPE("redrawWidgets");
 
 	for (i = 0; i < _widgetCount; i++) {
 		if (!_widgets[i]->isHidden()) {
@@ -1384,6 +1386,7 @@ BilistNode<GuiWindow> *GuiView::selectCurrentWindow(int x, int y,
 
 void GuiView::redrawWindows(unsigned curtick) {
 	BilistNode<GuiWindow> *node = _lastWindow.prev();
+	PROFILE_SCOPE("redrawWindows");
 
 	for (; node && node != &_firstWindow; node = node->prev()) {
 		node->data->redraw(curtick);
@@ -1472,6 +1475,10 @@ TransitionView::~TransitionView(void) {
 	gameAssets->freeAsset(_animation);
 }
 
+const char *TransitionView::name(void) const {
+	return "TransitionView";
+}
+
 void TransitionView::redraw(unsigned curtick) {
 	unsigned frame, frameTime;
 
@@ -1510,6 +1517,181 @@ void TransitionView::handleMouseUp(int x, int y, unsigned button) {
 	exitView();
 }
 
+HitGrid::HitGrid(unsigned cellSize) : _entries(NULL), _cellStart(NULL),
+	_cellItems(NULL), _count(0), _size(0), _cellCount(0), _x(0), _y(0),
+	_dirty(0), _cols(0), _rows(0), _cellSize(cellSize) {
+
+	if (!cellSize) {
+		throw std::invalid_argument("Invalid hit grid cell size");
+	}
+}
+
+HitGrid::~HitGrid(void) {
+	delete[] _entries;
+	delete[] _cellStart;
+	delete[] _cellItems;
+}
+
+void HitGrid::cellRange(const HitEntry *ptr, unsigned *col1, unsigned *row1,
+	unsigned *col2, unsigned *row2) const {
+
+	*col1 = (ptr->x - _x) / _cellSize;
+	*row1 = (ptr->y - _y) / _cellSize;
+	*col2 = (ptr->x - _x + ptr->width - 1) / _cellSize;
+	*row2 = (ptr->y - _y + ptr->height - 1) / _cellSize;
+}
+
+void HitGrid::build(void) {
+	size_t i, total = 0;
+	unsigned col, row, col1, row1, col2, row2;
+	int x2, y2;
+	const HitEntry *ptr;
+
+	_dirty = 0;
+
+	if (!_count) {
+		_cols = _rows = 0;
+		return;
+	}
+
+	_x = _entries[0].x;
+	_y = _entries[0].y;
+	x2 = _x + _entries[0].width;
+	y2 = _y + _entries[0].height;
+
+	for (i = 1, ptr = _entries + 1; i < _count; i++, ptr++) {
+		_x = MIN(_x, ptr->x);
+		_y = MIN(_y, ptr->y);
+		x2 = MAX(x2, ptr->x + (int)ptr->width);
+		y2 = MAX(y2, ptr->y + (int)ptr->height);
+	}
+
+	_cols = (x2 - _x + _cellSize - 1) / _cellSize;
+	_rows = (y2 - _y + _cellSize - 1) / _cellSize;
+
+	if (_cols * _rows + 1 > _cellCount) {
+		delete[] _cellStart;
+		_cellStart = NULL;
+		_cellCount = 0;
+		_cellStart = new unsigned[_cols * _rows + 1];
+		_cellCount = _cols * _rows + 1;
+	}
+
+	memset(_cellStart, 0, (_cols * _rows + 1) * sizeof(unsigned));
+
+	// Count entries per cell, then turn counts into list offsets
+	for (i = 0, ptr = _entries; i < _count; i++, ptr++) {
+		cellRange(ptr, &col1, &row1, &col2, &row2);
+
+		for (row = row1; row <= row2; row++) {
+			for (col = col1; col <= col2; col++) {
+				_cellStart[row * _cols + col + 1]++;
+				total++;
+			}
+		}
+	}
+
+	for (i = 1; i <= _cols * _rows; i++) {
+		_cellStart[i] += _cellStart[i - 1];
+	}
+
+	delete[] _cellItems;
+	_cellItems = NULL;
+	_cellItems = new unsigned[total];
+
+	// Fill cell lists in insertion order
+	for (i = 0, ptr = _entries; i < _count; i++, ptr++) {
+		cellRange(ptr, &col1, &row1, &col2, &row2);
+
+		for (row = row1; row <= row2; row++) {
+			for (col = col1; col <= col2; col++) {
+				_cellItems[_cellStart[row * _cols + col]++] = i;
+			}
+		}
+	}
+
+	// The fill pass shifted each offset to the start of the next cell
+	for (i = _cols * _rows; i > 0; i--) {
+		_cellStart[i] = _cellStart[i - 1];
+	}
+
+	_cellStart[0] = 0;
+}
+
+void HitGrid::clear(void) {
+	_count = 0;
+	_dirty = 1;
+}
+
+void HitGrid::add(int x, int y, unsigned width, unsigned height, int id,
+	void *data) {
+
+	HitEntry *tmp;
+
+	if (!width || !height) {
+		return;
+	}
+
+	if (_count >= _size) {
+		size_t size = _size ? 2 * _size : 64;
+
+		tmp = new HitEntry[size];
+		memcpy(tmp, _entries, _count * sizeof(HitEntry));
+		delete[] _entries;
+		_entries = tmp;
+		_size = size;
+	}
+
+	tmp = _entries + _count++;
+	tmp->x = x;
+	tmp->y = y;
+	tmp->width = width;
+	tmp->height = height;
+	tmp->id = id;
+	tmp->data = data;
+	_dirty = 1;
+}
+
+int HitGrid::find(int x, int y, int *id, void **data) {
+	unsigned i, cell;
+	const HitEntry *ptr;
+
+	if (_dirty) {
+		build();
+	}
+
+	if (x < _x || y < _y) {
+		return 0;
+	}
+
+	if (unsigned(x - _x) / _cellSize >= _cols ||
+		unsigned(y - _y) / _cellSize >= _rows) {
+		return 0;
+	}
+
+	cell = ((y - _y) / _cellSize) * _cols + (x - _x) / _cellSize;
+
+	for (i = _cellStart[cell]; i < _cellStart[cell + 1]; i++) {
+		ptr = _entries + _cellItems[i];
+
+		if (isInRect(x, y, ptr->x, ptr->y, ptr->width, ptr->height)) {
+			*id = ptr->id;
+
+			if (data) {
+				*data = ptr->data;
+			}
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+size_t HitGrid::size(void) const {
+	return _count;
+}
+
 ViewStack::ViewStack(void) : _stack(NULL), _top(0), _size(8) {
 	_stack = new GuiView*[_size];
 	_stack[0] = NULL;
@@ -432,6 +432,9 @@ public:
 	virtual void open(void);
 	virtual void close(void);
 
+	// Readable view name for profiling reports
+	virtual const char *name(void) const = 0;
+
 	// Discard this instance from view stack and switch to the next view
 	// (if any). It is safe to access instance variable after calling
 	// this method. The instance will be garbage collected after control
@@ -458,6 +461,7 @@ public:
 		int y = 0);
 	~TransitionView(void);
 
+	const char *name(void) const;
 	void redraw(unsigned curtick);
 
 	void handleMouseMove(int x, int y, unsigned buttons);
@@ -465,6 +469,45 @@ public:
 	void handleMouseUp(int x, int y, unsigned button);
 };
 
+// Uniform grid of screen rectangles for fast hit testing. Rectangles
+// are indexed lazily on the first find() after changes. When rectangles
+// overlap, find() returns the one which was added first.
+class HitGrid {
+private:
+	struct HitEntry {
+		int x, y;
+		unsigned width, height;
+		int id;
+		void *data;
+	};
+
+	HitEntry *_entries;
+	unsigned *_cellStart, *_cellItems;
+	size_t _count, _size, _cellCount;
+	int _x, _y, _dirty;
+	unsigned _cols, _rows, _cellSize;
+
+	// Do NOT implement
+	HitGrid(const HitGrid &other);
+	const HitGrid &operator=(const HitGrid &other);
+
+	void cellRange(const HitEntry *ptr, unsigned *col1, unsigned *row1,
+		unsigned *col2, unsigned *row2) const;
+	void build(void);
+
+public:
+	explicit HitGrid(unsigned cellSize = 32);
+	~HitGrid(void);
+
+	void clear(void);
+	void add(int x, int y, unsigned width, unsigned height, int id,
+		void *data = NULL);
+
+	// Returns 0 if no rectangle contains the point
+	int find(int x, int y, int *id, void **data = NULL);
+	size_t size(void) const;
+};
+
 class ViewStack {
 private:
 	GuiView **_stack;
@@ -0,0 +1,112 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include "inputlog.h"
+
+#define INPUTLOG_MAGIC "OO2I"
+#define INPUTLOG_VERSION 1
+
+InputRecorder::InputRecorder(const char *filename) {
+	if (!_file.open(filename, File::WRITE | File::TRUNCATE)) {
+		throw std::runtime_error("Cannot create input log");
+	}
+
+	_file.write(INPUTLOG_MAGIC, 4);
+	_file.writeUint8(INPUTLOG_VERSION);
+}
+
+void InputRecorder::write(const InputEvent &ev) {
+	_file.writeUint8(ev.type);
+
+	switch (ev.type) {
+	case INPUT_FRAME:
+	case INPUT_KEY_DOWN:
+		_file.writeUint32LE(ev.arg);
+		break;
+
+	case INPUT_MOUSE_MOVE:
+	case INPUT_MOUSE_DOWN:
+	case INPUT_MOUSE_UP:
+		_file.writeSint16LE(ev.x);
+		_file.writeSint16LE(ev.y);
+		_file.writeUint8(ev.arg);
+		break;
+
+	case INPUT_QUIT:
+		break;
+
+	default:
+		throw std::invalid_argument("Invalid input event type");
+	}
+}
+
+InputReplay::InputReplay(const char *filename) {
+	char buf[4];
+
+	if (!_file.open(filename)) {
+		throw std::runtime_error("Cannot open input log");
+	}
+
+	if (_file.read(buf, 4) != 4 || memcmp(buf, INPUTLOG_MAGIC, 4)) {
+		throw std::runtime_error("Not an input log file");
+	}
+
+	if (_file.readUint8() != INPUTLOG_VERSION) {
+		throw std::runtime_error("Unsupported input log version");
+	}
+}
+
+int InputReplay::read(InputEvent &ev) {
+	ev.type = _file.readUint8();
+	ev.x = ev.y = 0;
+	ev.arg = 0;
+
+	if (_file.eos()) {
+		return 0;
+	}
+
+	switch (ev.type) {
+	case INPUT_FRAME:
+	case INPUT_KEY_DOWN:
+		ev.arg = _file.readUint32LE();
+		break;
+
+	case INPUT_MOUSE_MOVE:
+	case INPUT_MOUSE_DOWN:
+	case INPUT_MOUSE_UP:
+		ev.x = _file.readSint16LE();
+		ev.y = _file.readSint16LE();
+		ev.arg = _file.readUint8();
+		break;
+
+	case INPUT_QUIT:
+		break;
+
+	default:
+		throw std::runtime_error("Corrupted input log");
+	}
+
+	if (_file.eos()) {
+		throw std::runtime_error("Premature end of input log");
+	}
+
+	return 1;
+}
@@ -0,0 +1,72 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INPUTLOG_H_
+#define INPUTLOG_H_
+
+#include <cstdint>
+#include "stream.h"
+
+// Input event types. INPUT_FRAME ends the list of events dispatched
+// in one iteration of the main loop and holds the tick passed to redraw().
+#define INPUT_FRAME 0
+#define INPUT_MOUSE_MOVE 1
+#define INPUT_MOUSE_DOWN 2
+#define INPUT_MOUSE_UP 3
+#define INPUT_KEY_DOWN 4
+#define INPUT_QUIT 5
+
+// arg is button state for INPUT_MOUSE_MOVE, button for INPUT_MOUSE_DOWN/UP,
+// key code for INPUT_KEY_DOWN and tick for INPUT_FRAME
+struct InputEvent {
+	unsigned type;
+	int x, y;
+	uint32_t arg;
+};
+
+class InputRecorder {
+private:
+	File _file;
+
+	// Do NOT implement
+	InputRecorder(const InputRecorder &other);
+	const InputRecorder &operator=(const InputRecorder &other);
+
+public:
+	explicit InputRecorder(const char *filename);
+
+	void write(const InputEvent &ev);
+};
+
+class InputReplay {
+private:
+	File _file;
+
+	// Do NOT implement
+	InputReplay(const InputReplay &other);
+	const InputReplay &operator=(const InputReplay &other);
+
+public:
+	explicit InputReplay(const char *filename);
+
+	// Returns 0 at the end of the log
+	int read(InputEvent &ev);
+};
+
+#endif
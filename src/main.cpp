@@ -18,6 +18,7 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <clocale>
 #include <SDL.h>
@@ -54,6 +55,7 @@ void prepare_main_menu(void) {
 }
 
 void engine_shutdown(void) {
+	finishAutosave();
 	delete gui_stack;
 	GarbageCollector::flush();
 	delete gameFonts;
@@ -64,6 +66,26 @@ void engine_shutdown(void) {
 }
 
 int main(int argc, char **argv) {
+	int i, headless = 0;
+	const char *savefile = NULL, *record = NULL, *replay = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			record = argv[++i];
+		} else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+			replay = argv[++i];
+		} else if (!strcmp(argv[i], "--headless")) {
+			headless = 1;
+		} else {
+			savefile = argv[i];
+		}
+	}
+
+	if (headless && !replay) {
+		fprintf(stderr, "Error: --headless requires --replay\n");
+		return 1;
+	}
+
 	// Honor system locale
 	setlocale(LC_ALL, "");
 
@@ -71,7 +93,7 @@ int main(int argc, char **argv) {
 		init_paths(argv[0]);
 		gameAssets = new AssetManager;
 		gui_stack = new ViewStack;
-		initScreen();
+		initScreen(headless);
 		// FIXME: Select language from game config
 		selectLanguage(LANG_ENGLISH);
 	} catch(std::exception &e) {
@@ -81,13 +103,22 @@ int main(int argc, char **argv) {
 	}
 
 	try {
-		if (argc >= 2) {
+		if (record) {
+			recordInput(record);
+		}
+
+		if (replay) {
+			replayInput(replay, headless);
+		}
+
+		if (savefile) {
 			GameState* game = NULL;
 			GuiView *view = NULL;
 
 			try {
 				game = new GameState;
-				game->load(argv[1]);
+				game->load(savefile, GAMESTATE_VALIDATE_FULL,
+					cpu_count());
 				game->dump();
 				view = new GalaxyView(game);
 				game = NULL;
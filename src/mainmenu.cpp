@@ -49,24 +49,292 @@
 #define ASSET_LOAD_NETWORK 25
 #define ASSET_LOAD_MODEM 26
 
-SaveGameInfo::SaveGameInfo(void) : filename(NULL), mtime(0) {
+#define SAVEGAME_INDEX_FILE "savegame.idx"
+#define SAVEGAME_INDEX_MAGIC 0x58444953 // "SIDX"
+#define SAVEGAME_INDEX_MAX_NAME 255
+
+SaveGameInfo::SaveGameInfo(void) : filename(NULL), mtime(0), size(0),
+	inode(0) {
 
 }
 
+SaveGameInfo::SaveGameInfo(const SaveGameInfo &other) : filename(NULL),
+	mtime(other.mtime), size(other.size), inode(other.inode),
+	header(other.header) {
+
+	if (other.filename) {
+		filename = copystr(other.filename);
+	}
+}
+
 SaveGameInfo::~SaveGameInfo(void) {
 	delete[] filename;
 }
 
-SaveGameInfo *findSavedGames(void) {
+const SaveGameInfo &SaveGameInfo::operator=(const SaveGameInfo &other) {
+	char *tmp = NULL;
+
+	if (this == &other) {
+		return *this;
+	}
+
+	if (other.filename) {
+		tmp = copystr(other.filename);
+	}
+
+	delete[] filename;
+	filename = tmp;
+	mtime = other.mtime;
+	size = other.size;
+	inode = other.inode;
+	header = other.header;
+	return *this;
+}
+
+int SaveGameInfo::isSameFile(const SaveGameInfo &other) const {
+	if (!filename || !other.filename || strcmp(filename, other.filename)) {
+		return 0;
+	}
+
+	return mtime == other.mtime && size == other.size &&
+		inode == other.inode;
+}
+
+// Returns zero-based slot number or -1 if the name is not a savegame file
+static int savegameSlot(const char *name) {
 	unsigned slot;
 	int tmp;
-	char c, empty;
+	char c, empty, *fname;
+
+	fname = strlower(name);
+	tmp = sscanf(fname, "save%u.ga%c%c", &slot, &c, &empty);
+	delete[] fname;
+
+	if (tmp != 2 || c != 'm' || slot < 1 || slot > SAVEGAME_SLOTS) {
+		return -1;
+	}
+
+	return slot - 1;
+}
+
+static int parseSavegameHeader(SaveGameInfo &info) {
+	char *path = configPath(info.filename);
+	File fr;
+
+	fr.open(path);
+	delete[] path;
+
+	if (!fr.isOpen()) {
+		return 0;
+	}
+
+	try {
+		info.header.load(fr);
+	} catch (...) {
+		return 0;
+	}
+
+	return !fr.eos();
+}
+
+// Index file errors are never fatal, the slots will be parsed again
+static void loadSavegameIndex(SaveGameInfo *slots) {
+	unsigned i, count, length;
+	int slot;
+	char *path = configPath(SAVEGAME_INDEX_FILE);
+	SaveGameInfo info;
+	File fr;
+
+	fr.open(path);
+	delete[] path;
+
+	if (!fr.isOpen()) {
+		return;
+	}
+
+	try {
+		if (fr.readUint32LE() != SAVEGAME_INDEX_MAGIC) {
+			return;
+		}
+
+		count = fr.readUint32LE();
+
+		for (i = 0; i < count && i < SAVEGAME_SLOTS; i++) {
+			length = fr.readUint16LE();
+
+			if (!length || length > SAVEGAME_INDEX_MAX_NAME) {
+				return;
+			}
+
+			delete[] info.filename;
+			info.filename = NULL;
+			info.filename = new char[length + 1];
+
+			if (fr.read(info.filename, length) != length) {
+				return;
+			}
+
+			info.filename[length] = '\0';
+			info.size = fr.readUint64LE();
+			info.mtime = (time_t)fr.readSint64LE();
+			info.inode = fr.readUint64LE();
+			info.header.load(fr);
+
+			if (fr.eos()) {
+				return;
+			}
+
+			slot = savegameSlot(info.filename);
+
+			if (slot >= 0) {
+				slots[slot] = info;
+			}
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "Warning: invalid savegame index: %s\n",
+			e.what());
+	}
+}
+
+SaveGameScan::SaveGameScan(void) : _revision(0), _done(0), _error(0),
+	_released(0), _jobCount(0), _nextJob(0) {
+
+	memset(_slotRevision, 0, sizeof(_slotRevision));
+}
+
+SaveGameScan::~SaveGameScan(void) {
+	_thread.join();
+}
+
+int SaveGameScan::scanThread(void *arg) {
+	SaveGameScan *self = (SaveGameScan*)arg;
+	int error = 0, released;
+
+	try {
+		self->scan();
+	} catch (std::exception &e) {
+		fprintf(stderr, "Savegame scan failed: %s\n", e.what());
+		error = 1;
+	}
+
+	self->_mutex.lock();
+	self->_error = error;
+	self->_done = 1;
+	released = self->_released;
+	self->_mutex.unlock();
+
+	// The window was closed before the scan finished
+	if (released) {
+		delete self;
+	}
+
+	return 0;
+}
+
+int SaveGameScan::parseThread(void *arg) {
+	SaveGameScan *self = (SaveGameScan*)arg;
+	unsigned i;
+
+	while ((i = self->_nextJob++) < self->_jobCount) {
+		if (parseSavegameHeader(self->_jobs[i])) {
+			self->publish(self->_jobSlots[i], self->_jobs[i]);
+		}
+	}
+
+	return 0;
+}
+
+void SaveGameScan::publish(unsigned slot, const SaveGameInfo &info) {
+	AutoMutex lock(_mutex);
+
+	_slots[slot] = info;
+	_slotRevision[slot] = ++_revision;
+}
+
+void SaveGameScan::parseFiles(void) {
+	unsigned i, count;
+
+	if (!_jobCount) {
+		return;
+	}
+
+	count = MIN(_jobCount, SAVEGAME_SCAN_THREADS);
+	_nextJob = 0;
+
+	for (i = 0; i + 1 < count; i++) {
+		try {
+			_workers[i].start(parseThread, this, "savegame parse");
+		} catch (...) {
+			// The calling thread will pick up the remaining files
+			break;
+		}
+	}
+
+	parseThread(this);
+
+	for (count = i, i = 0; i < count; i++) {
+		_workers[i].join();
+	}
+}
+
+void SaveGameScan::writeIndex(void) {
+	unsigned i, count = 0;
+	long pos;
+	File fw;
+	MemoryWriteStream data;
+	StringBuffer path, tmpname;
+	char *tmp;
+
+	data.writeUint32LE(SAVEGAME_INDEX_MAGIC);
+	pos = data.pos();
+	data.writeUint32LE(0);
+
+	_mutex.lock();
+
+	for (i = 0; i < SAVEGAME_SLOTS; i++) {
+		if (!_slots[i].filename) {
+			continue;
+		}
+
+		data.writeUint16LE(strlen(_slots[i].filename));
+		data.write(_slots[i].filename, strlen(_slots[i].filename));
+		data.writeUint64LE(_slots[i].size);
+		data.writeSint64LE(_slots[i].mtime);
+		data.writeUint64LE(_slots[i].inode);
+		_slots[i].header.save(data);
+		count++;
+	}
+
+	_mutex.unlock();
+	data.seek(pos, SEEK_SET);
+	data.writeUint32LE(count);
+
+	tmp = configPath(SAVEGAME_INDEX_FILE);
+	path = tmp;
+	tmpname = tmp;
+	delete[] tmp;
+	tmpname.append(".tmp");
+
+	if (!fw.open(tmpname.c_str(), File::WRITE | File::TRUNCATE)) {
+		throw std::runtime_error("Cannot create savegame index");
+	}
+
+	if (fw.write(data.dataPtr(), data.size()) != data.size()) {
+		throw std::runtime_error("Cannot write savegame index");
+	}
+
+	fw.close();
+	replace_file(tmpname.c_str(), path.c_str());
+}
+
+void SaveGameScan::scan(void) {
+	unsigned i;
+	int slot, tmp, stale = 0;
 	DIR *dptr;
 	struct dirent *entry;
 	struct stat stbuf;
-	char *fname, *path = configPath(NULL);
-	SaveGameInfo *ret;
-	File fr;
+	char *path = configPath(NULL);
+	SaveGameInfo cache[SAVEGAME_SLOTS], found[SAVEGAME_SLOTS];
 
 	dptr = opendir(path);
 	delete[] path;
@@ -75,53 +343,125 @@ SaveGameInfo *findSavedGames(void) {
 		throw std::runtime_error("Could not open savegame directory");
 	}
 
-	try {
-		ret = new SaveGameInfo[SAVEGAME_SLOTS];
-	} catch (...) {
-		closedir(dptr);
-		throw;
-	}
-
 	while ((entry = readdir(dptr))) {
-		fname = strlower(entry->d_name);
-		tmp = sscanf(fname, "save%d.ga%c%c", &slot, &c, &empty);
-		delete[] fname;
+		slot = savegameSlot(entry->d_name);
 
-		if (tmp != 2 || c != 'm' || slot < 1 || slot > SAVEGAME_SLOTS) {
+		if (slot < 0) {
 			continue;
 		}
 
-		--slot;
 		path = configPath(entry->d_name);
 		tmp = stat(path, &stbuf);
-		fr.open(path);
 		delete[] path;
 
-		if (tmp || !S_ISREG(stbuf.st_mode) || !fr.isOpen()) {
+		if (tmp || !S_ISREG(stbuf.st_mode)) {
 			continue;
 		}
 
-		if (ret[slot].filename) {
-			fprintf(stderr, "Warning: duplicate savegame file in slot %u\n", slot);
+		if (found[slot].filename) {
+			fprintf(stderr, "Warning: duplicate savegame file in slot %d\n", slot);
 			continue;
 		}
 
 		try {
-			ret[slot].header.load(fr);
+			found[slot].filename = copystr(entry->d_name);
 		} catch (...) {
-			continue;
+			closedir(dptr);
+			throw;
 		}
 
-		if (fr.eos()) {
+		found[slot].mtime = stbuf.st_mtime;
+		found[slot].size = stbuf.st_size;
+		found[slot].inode = stbuf.st_ino;
+	}
+
+	closedir(dptr);
+	loadSavegameIndex(cache);
+
+	// Publish cached headers right away, queue the rest for parsing
+	for (i = 0; i < SAVEGAME_SLOTS; i++) {
+		if (found[i].isSameFile(cache[i])) {
+			found[i].header = cache[i].header;
+			publish(i, found[i]);
 			continue;
 		}
 
-		fr.close();
-		ret[slot].filename = copystr(entry->d_name);
-		ret[slot].mtime = stbuf.st_mtime;
+		if (cache[i].filename) {
+			stale = 1;
+		}
+
+		if (found[i].filename) {
+			_jobs[_jobCount] = found[i];
+			_jobSlots[_jobCount++] = i;
+			stale = 1;
+		}
 	}
 
-	closedir(dptr);
+	parseFiles();
+
+	if (stale) {
+		try {
+			writeIndex();
+		} catch (std::exception &e) {
+			fprintf(stderr, "Warning: %s\n", e.what());
+		}
+	}
+}
+
+void SaveGameScan::start(void) {
+	_thread.start(scanThread, this, "savegame scan");
+}
+
+void SaveGameScan::run(void) {
+	scan();
+}
+
+unsigned SaveGameScan::update(SaveGameInfo *slots, unsigned revision) {
+	unsigned i;
+	AutoMutex lock(_mutex);
+
+	for (i = 0; i < SAVEGAME_SLOTS; i++) {
+		if (_slotRevision[i] > revision) {
+			slots[i] = _slots[i];
+		}
+	}
+
+	return _revision;
+}
+
+int SaveGameScan::hasFailed(void) {
+	AutoMutex lock(_mutex);
+
+	return _error;
+}
+
+void SaveGameScan::release(void) {
+	int done;
+
+	_mutex.lock();
+	done = _done;
+
+	// Detach under lock so that the scan thread cannot delete this
+	// object before the thread handle is released
+	if (!done) {
+		_released = 1;
+		_thread.detach();
+	}
+
+	_mutex.unlock();
+
+	if (done) {
+		delete this;
+	}
+}
+
+SaveGameInfo *findSavedGames(void) {
+	SaveGameInfo *ret;
+	SaveGameScan scan;
+
+	scan.run();
+	ret = new SaveGameInfo[SAVEGAME_SLOTS];
+	scan.update(ret, 0);
 	return ret;
 }
 
@@ -133,7 +473,8 @@ void loadGame(const char *filename) {
 	try {
 		path = configPath(filename);
 		game = new GameState;
-		game->load(path);
+		// Skip deep validation of unmodified saves written by us
+		game->load(path, GAMESTATE_VALIDATE_TRUSTED, cpu_count());
 		view = new GalaxyView(game);
 		game = NULL;
 		gui_stack->push(view);
@@ -172,6 +513,65 @@ int loadGame(GuiView *view, const SaveGameInfo *files, unsigned slot) {
 	return 1;
 }
 
+int saveGame(GuiView *view, const GameState *game) {
+	unsigned i, slot = 0;
+	char *path = NULL;
+	SaveGameInfo *saveFiles = NULL;
+	StringBuffer buf;
+
+	try {
+		saveFiles = findSavedGames();
+
+		for (i = 0; i < SAVEGAME_SLOTS - 1; i++) {
+			if (!saveFiles[i].filename) {
+				slot = i;
+				break;
+			}
+
+			if (saveFiles[i].mtime < saveFiles[slot].mtime) {
+				slot = i;
+			}
+		}
+
+		if (saveFiles[slot].filename) {
+			buf = saveFiles[slot].filename;
+		} else {
+			buf.printf("SAVE%u.GAM", slot + 1);
+		}
+
+		path = configPath(buf.c_str());
+		game->save(path);
+	} catch (std::exception &e) {
+		fprintf(stderr, "Error saving game: %s\n", e.what());
+		delete[] saveFiles;
+		delete[] path;
+		new ErrorWindow(view, "Cannot save game");
+		return 0;
+	}
+
+	delete[] saveFiles;
+	delete[] path;
+	buf.printf("Game saved to slot %u", slot + 1);
+	new MessageBoxWindow(view, buf.c_str());
+	return 1;
+}
+
+void autosaveGame(const GameState *game) {
+	char *path;
+	StringBuffer buf;
+
+	buf.printf("SAVE%u.GAM", SAVEGAME_SLOTS);
+	path = configPath(buf.c_str());
+
+	try {
+		game->autosave(path);
+	} catch (std::exception &e) {
+		fprintf(stderr, "Autosave failed: %s\n", e.what());
+	}
+
+	delete[] path;
+}
+
 MainMenuView::MainMenuView(void) {
 	_background = gameAssets->getImage(MENU_ARCHIVE, ASSET_MENU_BACKGROUND);
 
@@ -272,6 +672,10 @@ void MainMenuView::initWidgets(void) {
 	w->setMouseOverSprite(MENU_ARCHIVE, ASSET_MENU_QUIT, pal, 0);
 }
 
+const char *MainMenuView::name(void) const {
+	return "MainMenuView";
+}
+
 void MainMenuView::redraw(unsigned curtick) {
 	_background->draw(0, 0);
 	redrawWidgets(0, 0, curtick);
@@ -320,7 +724,7 @@ void MainMenuView::clickQuit(int x, int y, int arg) {
 
 LoadGameWindow::LoadGameWindow(GuiView *parent, int quickload) :
 	GuiWindow(parent, WINDOW_MODAL), _quickload(quickload), _selected(-1),
-	_saveFiles(NULL) {
+	_saveFiles(NULL), _scan(NULL), _scanRevision(0) {
 
 	ImageAsset tmp;
 	const uint8_t *pal;
@@ -344,10 +748,22 @@ LoadGameWindow::LoadGameWindow(GuiView *parent, int quickload) :
 	_y = (SCREEN_HEIGHT - _height) / 2;
 
 	initWidgets(pal);
-	_saveFiles = findSavedGames();
+	_saveFiles = new SaveGameInfo[SAVEGAME_SLOTS];
+
+	// Slots get filled in by redraw() as the scan finds them
+	try {
+		_scan = new SaveGameScan;
+		_scan->start();
+	} catch (...) {
+		delete _scan;
+		delete[] _saveFiles;
+		throw;
+	}
 }
 
 LoadGameWindow::~LoadGameWindow(void) {
+	// Do not block the GUI on a slow directory scan
+	_scan->release();
 	delete[] _saveFiles;
 }
 
@@ -429,8 +845,15 @@ void LoadGameWindow::redraw(unsigned curtick) {
 	Font *fnt, *smallfnt;
 	int i;
 
+	if (_scan->hasFailed()) {
+		new ErrorWindow(_parent, "Cannot read saved games");
+		close();
+		return;
+	}
+
 	fnt = gameFonts->getFont(FONTSIZE_SMALL);
 	smallfnt = gameFonts->getFont(FONTSIZE_SMALLER);
+	_scanRevision = _scan->update(_saveFiles, _scanRevision);
 
 	_bg->draw(_x, _y);
 	redrawWidgets(_x, _y, curtick);
@@ -26,6 +26,7 @@
 #include "gamestate.h"
 
 #define SAVEGAME_SLOTS 10
+#define SAVEGAME_SCAN_THREADS 4
 
 class MainMenuView : public GuiView {
 private:
@@ -37,6 +38,7 @@ public:
 	MainMenuView(void);
 	~MainMenuView(void);
 
+	const char *name(void) const;
 	void redraw(unsigned curtick);
 
 	void showHelp(int x, int y, int arg);
@@ -51,17 +53,85 @@ public:
 struct SaveGameInfo {
 	char *filename;
 	time_t mtime;
+	uint64_t size, inode;
 	GameConfig header;
 
 	SaveGameInfo(void);
+	SaveGameInfo(const SaveGameInfo &other);
 	~SaveGameInfo(void);
+
+	const SaveGameInfo &operator=(const SaveGameInfo &other);
+	// Same file with the same size and modification time
+	int isSameFile(const SaveGameInfo &other) const;
 };
 
+// Savegame slot scan. Headers of unchanged files are taken from an index
+// file in config directory, new and changed files are parsed in parallel.
+class SaveGameScan {
+private:
+	Mutex _mutex;
+	Thread _thread, _workers[SAVEGAME_SCAN_THREADS - 1];
+	SaveGameInfo _slots[SAVEGAME_SLOTS];
+	unsigned _revision, _slotRevision[SAVEGAME_SLOTS];
+	int _done, _error, _released;
+
+	// Files which need parsing, owned by the scanning thread
+	SaveGameInfo _jobs[SAVEGAME_SLOTS];
+	unsigned _jobSlots[SAVEGAME_SLOTS], _jobCount;
+	std::atomic<unsigned> _nextJob;
+
+	static int scanThread(void *arg);
+	static int parseThread(void *arg);
+
+	void scan(void);
+	void parseFiles(void);
+	void publish(unsigned slot, const SaveGameInfo &info);
+	void writeIndex(void);
+
+	// Do NOT implement
+	SaveGameScan(const SaveGameScan &other);
+	const SaveGameScan &operator=(const SaveGameScan &other);
+
+public:
+	SaveGameScan(void);
+	// Waits for running scan to finish
+	~SaveGameScan(void);
+
+	// Scan in background thread
+	void start(void);
+	// Scan in calling thread, throws exception on error
+	void run(void);
+
+	// Copy slots which changed since given revision and return the current
+	// revision. Start with revision 0.
+	unsigned update(SaveGameInfo *slots, unsigned revision);
+	// Returns nonzero if the background scan could not read the savegame
+	// directory
+	int hasFailed(void);
+	// Delete this object without waiting for the background scan, the scan
+	// thread deletes it when it finishes. Do not use the object afterwards.
+	void release(void);
+};
+
+// Returns newly allocated array of SAVEGAME_SLOTS entries
+SaveGameInfo *findSavedGames(void);
+
+// Save game into the first empty slot or overwrite the oldest savegame.
+// There is no slot selection, the message box after saving tells the player
+// which slot was used. The last slot is reserved for autosave. Returns 0 and
+// shows error window on failure.
+int saveGame(GuiView *view, const GameState *game);
+
+// Write game to the autosave slot in background
+void autosaveGame(const GameState *game);
+
 class LoadGameWindow : public GuiWindow {
 private:
 	ImageAsset _bg, _singleIcon, _hotseatIcon, _networkIcon, _modemIcon;
 	int _quickload, _selected;
 	SaveGameInfo *_saveFiles;
+	SaveGameScan *_scan;
+	unsigned _scanRevision;
 
 	void initWidgets(const uint8_t *palette);
 
@@ -0,0 +1,274 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "stream.h"
+#include "lbx.h"
+#include "profiler.h"
+
+// Rolling window of frame times for the histogram
+#define FRAME_HISTORY 256
+#define HISTOGRAM_BUCKETS 16
+#define HISTOGRAM_BUCKET_SIZE 4000
+
+// Counter events store the counter value in duration
+struct TraceEvent {
+	const char *name;
+	uint64_t start, duration;
+	unsigned thread;
+	int counter;
+};
+
+int profiler_enabled = 0;
+uint64_t profile_counters[PROFILE_COUNTER_MAX];
+
+static Mutex trace_mutex;
+static TraceEvent *trace_events = NULL;
+static size_t trace_count = 0, trace_max = 0;
+static int tracing = 0;
+static unsigned thread_count = 0;
+
+static uint64_t frame_times[FRAME_HISTORY];
+static unsigned frame_histogram[HISTOGRAM_BUCKETS];
+static unsigned frame_pos = 0, frame_count = 0;
+static uint64_t last_frame = 0, frame_sum = 0;
+static uint64_t last_counters[PROFILE_COUNTER_MAX];
+
+static const char *counter_names[PROFILE_COUNTER_MAX] = {
+	"draw calls", "blit bytes"
+};
+
+static unsigned threadID(void) {
+	static thread_local unsigned id = 0;
+
+	if (!id) {
+		AutoMutex lock(trace_mutex);
+
+		id = ++thread_count;
+	}
+
+	return id;
+}
+
+// Caller must hold trace_mutex
+static void appendTraceEvent(const char *name, uint64_t start,
+	uint64_t duration, unsigned thread, int counter = 0) {
+
+	TraceEvent *tmp;
+
+	if (trace_count >= trace_max) {
+		size_t size = trace_max ? 2 * trace_max : 4096;
+
+		tmp = new TraceEvent[size];
+		memcpy(tmp, trace_events, trace_count * sizeof(TraceEvent));
+		delete[] trace_events;
+		trace_events = tmp;
+		trace_max = size;
+	}
+
+	trace_events[trace_count].name = name;
+	trace_events[trace_count].start = start;
+	trace_events[trace_count].duration = duration;
+	trace_events[trace_count].thread = thread;
+	trace_events[trace_count].counter = counter;
+	trace_count++;
+}
+
+static unsigned histogramBucket(uint64_t duration) {
+	return MIN(duration / HISTOGRAM_BUCKET_SIZE, HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t profileTime(void) {
+	std::chrono::steady_clock::duration now;
+
+	now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+void profileEvent(const char *name, uint64_t start) {
+	uint64_t end = profileTime();
+	unsigned thread;
+
+	if (!tracing) {
+		return;
+	}
+
+	thread = threadID();
+	AutoMutex lock(trace_mutex);
+
+	// Tracing may have stopped while we waited for the lock
+	if (tracing) {
+		appendTraceEvent(name, start, end - start, thread);
+	}
+}
+
+void enableProfiler(int enable) {
+	if (enable && !profiler_enabled) {
+		memset(profile_counters, 0, sizeof(profile_counters));
+		memset(last_counters, 0, sizeof(last_counters));
+		memset(frame_histogram, 0, sizeof(frame_histogram));
+		frame_pos = frame_count = 0;
+		frame_sum = 0;
+		last_frame = profileTime();
+	} else if (!enable && profiler_enabled) {
+		printFrameHistogram(stderr);
+		MemoryPool::printStats(stderr);
+	}
+
+	profiler_enabled = enable;
+}
+
+void startProfileTrace(void) {
+	AutoMutex lock(trace_mutex);
+
+	trace_count = 0;
+	tracing = 1;
+}
+
+void stopProfileTrace(const char *filename) {
+	size_t i;
+	File fw;
+	StringBuffer buf;
+	AutoMutex lock(trace_mutex);
+
+	tracing = 0;
+
+	if (!fw.open(filename, File::WRITE | File::TRUNCATE)) {
+		throw std::runtime_error("Cannot create trace file");
+	}
+
+	fprintf(stderr, "Writing %lu trace events to %s\n",
+		(unsigned long)trace_count, filename);
+	buf = "{\"traceEvents\":[\n";
+
+	for (i = 0; i < trace_count; i++) {
+		TraceEvent *ptr = trace_events + i;
+
+		if (ptr->counter) {
+			buf.append_printf("{\"name\":\"%s\",\"ph\":\"C\","
+				"\"ts\":%llu,\"pid\":1,\"args\":{\"value\":%llu}}",
+				ptr->name, (unsigned long long)ptr->start,
+				(unsigned long long)ptr->duration);
+		} else {
+			buf.append_printf("{\"name\":\"%s\",\"ph\":\"X\","
+				"\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u}",
+				ptr->name, (unsigned long long)ptr->start,
+				(unsigned long long)ptr->duration, ptr->thread);
+		}
+
+		buf.append(i + 1 < trace_count ? ",\n" : "\n");
+
+		if (buf.length() > 65536) {
+			fw.write(buf.c_str(), buf.length());
+			buf.truncate();
+		}
+	}
+
+	buf.append("]}\n");
+	fw.write(buf.c_str(), buf.length());
+	delete[] trace_events;
+	trace_events = NULL;
+	trace_count = trace_max = 0;
+}
+
+int isProfileTracing(void) {
+	return tracing;
+}
+
+void profileFrameEnd(void) {
+	unsigned i;
+	uint64_t now, duration;
+
+	if (!profiler_enabled) {
+		return;
+	}
+
+	now = profileTime();
+	duration = now - last_frame;
+	last_frame = now;
+
+	if (frame_count >= FRAME_HISTORY) {
+		frame_histogram[histogramBucket(frame_times[frame_pos])]--;
+		frame_sum -= frame_times[frame_pos];
+	} else {
+		frame_count++;
+	}
+
+	frame_times[frame_pos] = duration;
+	frame_histogram[histogramBucket(duration)]++;
+	frame_sum += duration;
+	frame_pos = (frame_pos + 1) % FRAME_HISTORY;
+
+	if (tracing) {
+		AutoMutex lock(trace_mutex);
+
+		for (i = 0; tracing && i < PROFILE_COUNTER_MAX; i++) {
+			appendTraceEvent(counter_names[i], now,
+				profile_counters[i], 0, 1);
+		}
+	}
+
+	memcpy(last_counters, profile_counters, sizeof(last_counters));
+	memset(profile_counters, 0, sizeof(profile_counters));
+}
+
+void printFrameHistogram(FILE *fw) {
+	unsigned i;
+
+	fprintf(fw, "Frame times over last %u frames:\n", frame_count);
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (!frame_histogram[i]) {
+			continue;
+		}
+
+		if (i < HISTOGRAM_BUCKETS - 1) {
+			fprintf(fw, "  %2u-%2u ms: %u\n",
+				i * HISTOGRAM_BUCKET_SIZE / 1000,
+				(i + 1) * HISTOGRAM_BUCKET_SIZE / 1000,
+				frame_histogram[i]);
+		} else {
+			fprintf(fw, "  %5u+ ms: %u\n",
+				i * HISTOGRAM_BUCKET_SIZE / 1000,
+				frame_histogram[i]);
+		}
+	}
+}
+
+void drawProfileOverlay(void) {
+	Font *fnt;
+	StringBuffer buf;
+	unsigned fps = 0;
+
+	if (!profiler_enabled || !gameFonts) {
+		return;
+	}
+
+	if (frame_sum) {
+		fps = (1000000ULL * frame_count) / frame_sum;
+	}
+
+	fnt = gameFonts->getFont(FONTSIZE_SMALL);
+	buf.printf("%u fps, %u draws, %lu KB blit", fps,
+		(unsigned)last_counters[PROFILE_DRAW_CALLS],
+		(unsigned long)(last_counters[PROFILE_BLIT_BYTES] / 1024));
+	fnt->renderText(4, 4, FONT_COLOR_DEFAULT, buf.c_str(), OUTLINE_FULL);
+}
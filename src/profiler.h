@@ -0,0 +1,86 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#define PROFILE_DRAW_CALLS 0
+#define PROFILE_BLIT_BYTES 1
+#define PROFILE_COUNTER_MAX 2
+
+// Time the rest of the enclosing block
+#define PROFILE_SCOPE(name) ProfileScope _profile_scope(name)
+
+extern int profiler_enabled;
+extern uint64_t profile_counters[PROFILE_COUNTER_MAX];
+
+// Monotonic time in microseconds
+uint64_t profileTime(void);
+// Record finished scope, name must be a string literal
+void profileEvent(const char *name, uint64_t start);
+
+class ProfileScope {
+private:
+	const char *_name;
+	uint64_t _start;
+	int _active;
+
+	// Do NOT implement
+	ProfileScope(const ProfileScope &other);
+	const ProfileScope &operator=(const ProfileScope &other);
+
+public:
+	explicit ProfileScope(const char *name) : _name(name), _start(0),
+		_active(profiler_enabled) {
+		if (_active) {
+			_start = profileTime();
+		}
+	}
+
+	~ProfileScope(void) {
+		if (_active) {
+			profileEvent(_name, _start);
+		}
+	}
+};
+
+inline void profileCount(unsigned counter, uint64_t value) {
+	if (profiler_enabled) {
+		profile_counters[counter] += value;
+	}
+}
+
+void enableProfiler(int enable);
+
+// Collect scope timings in memory and write them as Chrome trace JSON
+void startProfileTrace(void);
+void stopProfileTrace(const char *filename);
+int isProfileTracing(void);
+
+// Call once after each finished frame
+void profileFrameEnd(void);
+void printFrameHistogram(FILE *fw);
+
+// Show fps and last frame counters in the top left corner of the screen
+void drawProfileOverlay(void);
+
+#endif
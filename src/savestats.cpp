@@ -0,0 +1,654 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Headless savegame statistics tool. Loads savegames on a pool of threads
+// and prints one record per player, colony or fleet as JSON Lines or CSV.
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <clocale>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "lbx.h"
+#include "lang.h"
+#include "profiler.h"
+#include "system.h"
+#include "gamestate.h"
+
+#define STATS_FORMAT_JSONL 0
+#define STATS_FORMAT_CSV 1
+
+#define STATS_PLAYERS 0x1
+#define STATS_COLONIES 0x2
+#define STATS_FLEETS 0x4
+#define STATS_ALL (STATS_PLAYERS | STATS_COLONIES | STATS_FLEETS)
+
+#define STATS_MAX_THREADS 64
+// Flush buffered records to output when the buffer grows over this size
+#define STATS_FLUSH_SIZE 65536
+
+AssetManager *gameAssets = NULL;
+TextManager *gameLang = NULL;
+FontManager *gameFonts = NULL;
+
+static const char *playerColumns = "file,player,name,race,eliminated,"
+	"color,personality,objective,tax_rate,bc,population,food,industry,"
+	"research,command_points,freighters,research_topic,research_item";
+static const char *colonyColumns = "file,colony,owner,planet,star,outpost,"
+	"population,morale,pollution,food,industry,research,revenue";
+static const char *fleetColumns = "file,fleet,owner,status,star,"
+	"destination,x,y,ships,combat,support";
+
+struct StatsContext {
+	char **files;
+	unsigned fileCount;
+	unsigned entities;
+	int format;
+	FILE *output;
+	Mutex outputMutex;
+	std::atomic<unsigned> nextFile;
+	std::atomic<unsigned> failed;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> records;
+	std::atomic<int> writeError;
+
+	StatsContext(void) : files(NULL), fileCount(0), entities(STATS_ALL),
+		format(STATS_FORMAT_JSONL), output(stdout), nextFile(0),
+		failed(0), bytes(0), records(0), writeError(0) { }
+};
+
+// Formats one output record as JSON object or CSV row
+class StatsRecord {
+private:
+	StringBuffer &_buf;
+	int _format;
+
+	void appendString(const char *str, size_t maxlen);
+
+	// Do NOT implement
+	StatsRecord(const StatsRecord &other);
+	const StatsRecord &operator=(const StatsRecord &other);
+
+public:
+	StatsRecord(StringBuffer &buf, int format, const char *entity,
+		const char *filename);
+
+	void add(const char *name, long value);
+	void add(const char *name, const char *value, size_t maxlen);
+	void finish(void);
+};
+
+StatsRecord::StatsRecord(StringBuffer &buf, int format, const char *entity,
+	const char *filename) : _buf(buf), _format(format) {
+
+	if (_format == STATS_FORMAT_JSONL) {
+		_buf.append_printf("{\"entity\":\"%s\",\"file\":", entity);
+	}
+
+	appendString(filename, strlen(filename));
+}
+
+static int isPlainChar(unsigned char c, int format) {
+	if (format == STATS_FORMAT_CSV) {
+		return c != '"';
+	}
+
+	// Game strings are not UTF-8, escape everything outside ASCII
+	return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+}
+
+void StatsRecord::appendString(const char *str, size_t maxlen) {
+	size_t i, len;
+	unsigned char c;
+
+	_buf.append("\"");
+
+	for (i = 0; i < maxlen && str[i]; i += len) {
+		for (len = 0; i + len < maxlen && str[i + len] &&
+			isPlainChar(str[i + len], _format); len++);
+
+		if (len) {
+			_buf.append_printf("%.*s", (int)len, str + i);
+			continue;
+		}
+
+		c = str[i];
+		len = 1;
+
+		if (_format == STATS_FORMAT_CSV) {
+			_buf.append("\"\"");
+		} else if (c == '"' || c == '\\') {
+			_buf.append_printf("\\%c", c);
+		} else {
+			_buf.append_printf("\\u%04x", c);
+		}
+	}
+
+	_buf.append("\"");
+}
+
+void StatsRecord::add(const char *name, long value) {
+	if (_format == STATS_FORMAT_JSONL) {
+		_buf.append_printf(",\"%s\":%ld", name, value);
+	} else {
+		_buf.append_printf(",%ld", value);
+	}
+}
+
+void StatsRecord::add(const char *name, const char *value, size_t maxlen) {
+	if (_format == STATS_FORMAT_JSONL) {
+		_buf.append_printf(",\"%s\":", name);
+	} else {
+		_buf.append(",");
+	}
+
+	appendString(value, maxlen);
+}
+
+void StatsRecord::finish(void) {
+	_buf.append(_format == STATS_FORMAT_JSONL ? "}\n" : "\n");
+}
+
+static long starID(const GameState *game, const Star *ptr) {
+	return ptr ? ptr - game->_starSystems : -1;
+}
+
+static unsigned writePlayers(StringBuffer &buf, const StatsContext *ctx,
+	const char *filename, const GameState *game) {
+	unsigned i, count = MIN(game->_playerCount, MAX_PLAYERS);
+
+	for (i = 0; i < count; i++) {
+		const Player *ptr = game->_players + i;
+		StatsRecord rec(buf, ctx->format, "player", filename);
+
+		rec.add("player", i);
+		rec.add("name", ptr->name, PLAYER_NAME_SIZE);
+		rec.add("race", ptr->race, PLAYER_RACE_SIZE);
+		rec.add("eliminated", ptr->eliminated);
+		rec.add("color", ptr->color);
+		rec.add("personality", ptr->personality);
+		rec.add("objective", ptr->objective);
+		rec.add("tax_rate", ptr->taxRate);
+		rec.add("bc", ptr->BC);
+		rec.add("population", ptr->totalPop);
+		rec.add("food", ptr->foodProduced);
+		rec.add("industry", ptr->industryProduced);
+		rec.add("research", ptr->researchProduced);
+		rec.add("command_points", ptr->commandPoints);
+		rec.add("freighters", ptr->totalFreighters);
+		rec.add("research_topic", ptr->researchTopic);
+		rec.add("research_item", ptr->researchItem);
+		rec.finish();
+	}
+
+	return count;
+}
+
+static unsigned writeColonies(StringBuffer &buf, const StatsContext *ctx,
+	const char *filename, const GameState *game) {
+	unsigned i, ret = 0, count = MIN(game->_colonyCount, MAX_COLONIES);
+	long star;
+
+	for (i = 0; i < count; i++) {
+		const Colony *ptr = game->_colonies + i;
+
+		if (ptr->planet < 0) {
+			continue;	// Destroyed colony
+		}
+
+		// Lazy load does not validate, check planet ID here
+		star = ptr->planet < MIN(game->_planetCount, MAX_PLANETS) ?
+			game->_planets[ptr->planet].star : -1;
+
+		StatsRecord rec(buf, ctx->format, "colony", filename);
+
+		rec.add("colony", i);
+		rec.add("owner", ptr->owner);
+		rec.add("planet", ptr->planet);
+		rec.add("star", star);
+		rec.add("outpost", ptr->is_outpost);
+		rec.add("population", ptr->population);
+		rec.add("morale", ptr->morale);
+		rec.add("pollution", ptr->pollution);
+		rec.add("food", ptr->total_food);
+		rec.add("industry", ptr->net_industry);
+		rec.add("research", ptr->total_research);
+		rec.add("revenue", ptr->total_revenue);
+		rec.finish();
+		ret++;
+	}
+
+	return ret;
+}
+
+static void writeFleet(StringBuffer &buf, const StatsContext *ctx,
+	const char *filename, const GameState *game, const Fleet *flt,
+	unsigned id) {
+
+	StatsRecord rec(buf, ctx->format, "fleet", filename);
+
+	rec.add("fleet", id);
+	rec.add("owner", flt->getOwner());
+	rec.add("status", flt->getStatus());
+	rec.add("star", starID(game, flt->getOrbitedStar()));
+	rec.add("destination", starID(game, flt->getDestStar()));
+	rec.add("x", flt->getX());
+	rec.add("y", flt->getY());
+	rec.add("ships", flt->shipCount());
+	rec.add("combat", flt->combatCount());
+	rec.add("support", flt->supportCount());
+	rec.finish();
+}
+
+static unsigned writeFleets(StringBuffer &buf, const StatsContext *ctx,
+	const char *filename, const GameState *game) {
+	unsigned i, count = 0;
+	const BilistNode<Fleet> *node;
+
+	for (i = 0; i < game->_starSystemCount; i++) {
+		const Star *ptr = game->_starSystems + i;
+
+		for (node = ptr->getOrbitingFleets(); node;
+			node = node->next()) {
+			if (node->data) {
+				writeFleet(buf, ctx, filename, game, node->data,
+					count++);
+			}
+		}
+
+		for (node = ptr->getLeavingFleets(); node;
+			node = node->next()) {
+			if (node->data) {
+				writeFleet(buf, ctx, filename, game, node->data,
+					count++);
+			}
+		}
+	}
+
+	for (node = game->getMovingFleets(); node; node = node->next()) {
+		if (node->data) {
+			writeFleet(buf, ctx, filename, game, node->data,
+				count++);
+		}
+	}
+
+	return count;
+}
+
+static void flushOutput(StatsContext *ctx, StringBuffer &buf) {
+	AutoMutex lock(ctx->outputMutex);
+
+	if (fwrite(buf.c_str(), 1, buf.length(), ctx->output) !=
+		buf.length() && !ctx->writeError) {
+		fprintf(stderr, "Error: Cannot write output\n");
+		ctx->writeError = 1;
+	}
+
+	buf.truncate();
+}
+
+static void processFile(StatsContext *ctx, const char *filename,
+	StringBuffer &buf) {
+	unsigned sections = 0, count = 0;
+	GameState *game;
+	File fr;
+
+	if (!fr.open(filename)) {
+		throw std::runtime_error("Cannot open savegame file");
+	}
+
+	ctx->bytes += fr.size();
+	game = new GameState;
+
+	try {
+		// Fleets need the full load, everything else can skip
+		// validation and derived data. Files are already loaded in
+		// parallel, validate each of them on a single thread.
+		if (ctx->entities & STATS_FLEETS) {
+			game->load(filename, GAMESTATE_VALIDATE_TRUSTED, 1);
+		} else {
+			if (ctx->entities & STATS_PLAYERS) {
+				sections |= GAMESTATE_SECTION_PLAYERS;
+			}
+
+			if (ctx->entities & STATS_COLONIES) {
+				sections |= GAMESTATE_SECTION_COLONIES |
+					GAMESTATE_SECTION_PLANETS;
+			}
+
+			game->loadLazy(fr);
+			game->requireSections(sections);
+		}
+
+		if (ctx->entities & STATS_PLAYERS) {
+			count += writePlayers(buf, ctx, filename, game);
+		}
+
+		if (ctx->entities & STATS_COLONIES) {
+			count += writeColonies(buf, ctx, filename, game);
+		}
+
+		if (ctx->entities & STATS_FLEETS) {
+			count += writeFleets(buf, ctx, filename, game);
+		}
+	} catch (...) {
+		delete game;
+		throw;
+	}
+
+	delete game;
+	ctx->records += count;
+}
+
+static int statsWorker(void *arg) {
+	StatsContext *ctx = (StatsContext*)arg;
+	StringBuffer buf(STATS_FLUSH_SIZE);
+	unsigned i;
+	size_t length;
+
+	while ((i = ctx->nextFile++) < ctx->fileCount) {
+		length = buf.length();
+
+		try {
+			processFile(ctx, ctx->files[i], buf);
+		} catch (std::exception &e) {
+			fprintf(stderr, "Error: %s: %s\n", ctx->files[i],
+				e.what());
+			// Drop partial records of the failed file
+			buf.truncate(length);
+			ctx->failed++;
+		}
+
+		// Free discarded fleet list nodes
+		GarbageCollector::flush();
+
+		if (buf.length() >= STATS_FLUSH_SIZE) {
+			flushOutput(ctx, buf);
+		}
+	}
+
+	flushOutput(ctx, buf);
+	return 0;
+}
+
+static void addFile(StatsContext *ctx, const char *filename,
+	unsigned *maxFiles) {
+	char **tmp;
+
+	if (ctx->fileCount >= *maxFiles) {
+		unsigned size = *maxFiles ? 2 * *maxFiles : 256;
+
+		tmp = new char*[size];
+
+		if (ctx->fileCount) {
+			memcpy(tmp, ctx->files, ctx->fileCount * sizeof(char*));
+		}
+
+		delete[] ctx->files;
+		ctx->files = tmp;
+		*maxFiles = size;
+	}
+
+	ctx->files[ctx->fileCount++] = copystr(filename);
+}
+
+// Add all *.gam files in given directory, subdirectories are not scanned
+static void addDirectory(StatsContext *ctx, const char *path,
+	unsigned *maxFiles) {
+	DIR *dptr;
+	struct dirent *entry;
+	size_t len;
+	int skip;
+	char *fname;
+
+	dptr = opendir(path);
+
+	if (!dptr) {
+		throw std::runtime_error("Could not open directory");
+	}
+
+	try {
+		while ((entry = readdir(dptr))) {
+			fname = strlower(entry->d_name);
+			len = strlen(fname);
+			skip = len < 4 || strcmp(fname + len - 4, ".gam");
+			delete[] fname;
+
+			if (skip) {
+				continue;
+			}
+
+			fname = concatPath(path, entry->d_name);
+
+			try {
+				addFile(ctx, fname, maxFiles);
+			} catch (...) {
+				delete[] fname;
+				throw;
+			}
+
+			delete[] fname;
+		}
+	} catch (...) {
+		closedir(dptr);
+		throw;
+	}
+
+	closedir(dptr);
+}
+
+static unsigned parseEntities(const char *arg) {
+	unsigned ret = 0;
+	size_t len;
+
+	while (*arg) {
+		len = strcspn(arg, ",");
+
+		if (len == 7 && !strncmp(arg, "players", len)) {
+			ret |= STATS_PLAYERS;
+		} else if (len == 8 && !strncmp(arg, "colonies", len)) {
+			ret |= STATS_COLONIES;
+		} else if (len == 6 && !strncmp(arg, "fleets", len)) {
+			ret |= STATS_FLEETS;
+		} else if (len == 3 && !strncmp(arg, "all", len)) {
+			ret |= STATS_ALL;
+		} else {
+			return 0;
+		}
+
+		arg += len;
+		arg += *arg ? 1 : 0;
+	}
+
+	return ret;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [options] <savegame|directory>...\n"
+		"  --format jsonl|csv   Output format (default: jsonl)\n"
+		"  --entities LIST      Comma separated list of players, "
+		"colonies, fleets\n"
+		"                       or all (default: all)\n"
+		"  --threads N          Number of loader threads "
+		"(default: CPU count)\n"
+		"  --output FILE        Write records to FILE instead of "
+		"stdout\n", name);
+}
+
+static const char *csvHeader(unsigned entities) {
+	switch (entities) {
+	case STATS_PLAYERS:
+		return playerColumns;
+
+	case STATS_COLONIES:
+		return colonyColumns;
+
+	case STATS_FLEETS:
+		return fleetColumns;
+
+	default:
+		return NULL;
+	}
+}
+
+static void cleanup(StatsContext *ctx) {
+	unsigned i;
+
+	for (i = 0; i < ctx->fileCount; i++) {
+		delete[] ctx->files[i];
+	}
+
+	delete[] ctx->files;
+
+	if (ctx->output && ctx->output != stdout) {
+		fclose(ctx->output);
+	}
+}
+
+int main(int argc, char **argv) {
+	int i, ret = 0;
+	unsigned j, threadCount = 0, maxFiles = 0, startedCount = 0;
+	const char *outname = NULL;
+	uint64_t start, duration;
+	double seconds;
+	struct stat stbuf;
+	StatsContext ctx;
+	Thread *threads = NULL;
+
+	setlocale(LC_ALL, "");
+
+	try {
+		for (i = 1; i < argc; i++) {
+			if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+				i++;
+
+				if (!strcmp(argv[i], "jsonl")) {
+					ctx.format = STATS_FORMAT_JSONL;
+				} else if (!strcmp(argv[i], "csv")) {
+					ctx.format = STATS_FORMAT_CSV;
+				} else {
+					usage(argv[0]);
+					cleanup(&ctx);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--entities") &&
+				i + 1 < argc) {
+				ctx.entities = parseEntities(argv[++i]);
+
+				if (!ctx.entities) {
+					usage(argv[0]);
+					cleanup(&ctx);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--threads") &&
+				i + 1 < argc) {
+				threadCount = atoi(argv[++i]);
+			} else if (!strcmp(argv[i], "--output") &&
+				i + 1 < argc) {
+				outname = argv[++i];
+			} else if (argv[i][0] == '-') {
+				usage(argv[0]);
+				cleanup(&ctx);
+				return 1;
+			} else if (!stat(argv[i], &stbuf) &&
+				S_ISDIR(stbuf.st_mode)) {
+				addDirectory(&ctx, argv[i], &maxFiles);
+			} else {
+				addFile(&ctx, argv[i], &maxFiles);
+			}
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		cleanup(&ctx);
+		return 1;
+	}
+
+	if (!ctx.fileCount) {
+		usage(argv[0]);
+		cleanup(&ctx);
+		return 1;
+	}
+
+	// CSV columns differ between entity types
+	if (ctx.format == STATS_FORMAT_CSV && !csvHeader(ctx.entities)) {
+		fprintf(stderr, "Error: CSV output needs exactly one entity "
+			"type\n");
+		cleanup(&ctx);
+		return 1;
+	}
+
+	if (outname) {
+		ctx.output = fopen(outname, "w");
+
+		if (!ctx.output) {
+			fprintf(stderr, "Error: Cannot create %s\n", outname);
+			cleanup(&ctx);
+			return 1;
+		}
+	}
+
+	if (ctx.format == STATS_FORMAT_CSV) {
+		fprintf(ctx.output, "%s\n", csvHeader(ctx.entities));
+	}
+
+	threadCount = threadCount ? threadCount : cpu_count();
+	threadCount = MIN(threadCount, STATS_MAX_THREADS);
+	threadCount = MIN(threadCount, ctx.fileCount);
+	start = profileTime();
+
+	// The main thread works as one of the loaders
+	try {
+		threads = new Thread[threadCount - 1];
+
+		for (j = 0; j < threadCount - 1; j++) {
+			threads[j].start(statsWorker, &ctx, "savestats");
+			startedCount++;
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "Warning: %s, using %u threads\n", e.what(),
+			startedCount + 1);
+	}
+
+	statsWorker(&ctx);
+
+	for (j = 0; j < startedCount; j++) {
+		threads[j].join();
+	}
+
+	delete[] threads;
+	GarbageCollector::flush();
+	duration = profileTime() - start;
+	seconds = duration ? duration / 1000000.0 : 1e-6;
+
+	if (fflush(ctx.output) || ctx.writeError) {
+		fprintf(stderr, "Error: Cannot write output\n");
+		ret = 1;
+	}
+
+	fprintf(stderr, "Processed %u files (%u failed), %llu records "
+		"in %.3f s using %u threads: %.1f files/s, %.1f MB/s\n",
+		ctx.fileCount, (unsigned)ctx.failed,
+		(unsigned long long)ctx.records, seconds, startedCount + 1,
+		ctx.fileCount / seconds, ctx.bytes / seconds / 1048576.0);
+	cleanup(&ctx);
+	return ret || ctx.failed ? 1 : 0;
+}
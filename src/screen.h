@@ -26,11 +26,17 @@
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
 
-void initScreen(void);
+// Headless screen uses hidden window and skips presenting frames
+void initScreen(int headless = 0);
 void redrawScreen(void); // Refresh the screen using the last frame
 void updateScreen(void); // Finish drawing a frame and copy it to screen
 void shutdownScreen(void);
 
+// Retained mode compares draw calls with the previous frame and skips
+// redrawing screen regions that did not change. Views which enable it must
+// redraw the whole screen in every frame.
+void setRetainedMode(int enable);
+
 // registerTexture() must return (nearly) consecutive texture IDs.
 // If the backend does not guarantee consecutive integers, the implementation
 // must maintain an internal translation table.
@@ -41,6 +47,10 @@ void setTexturePalette(unsigned id, const uint8_t *palette,
 	unsigned firstcolor, unsigned colors);
 void freeTexture(unsigned id);
 
+// Finish all drawing so far and copy screen rectangle into new texture.
+// Useful for caching static parts of the screen.
+unsigned snapshotScreen(int x, int y, unsigned width, unsigned height);
+
 // Draw whole texture
 void drawTexture(unsigned id, int x, int y);
 
@@ -50,6 +60,11 @@ void drawTextureTile(unsigned id, int x, int y, int offsx, int offsy,
 
 void drawLine(int x1, int y1, int x2, int y2, uint8_t r, uint8_t g, uint8_t b);
 
+// Draw count line segments of the same color. The coords array contains
+// x1, y1, x2, y2 for each segment.
+void drawLines(const int *coords, unsigned count, uint8_t r, uint8_t g,
+	uint8_t b);
+
 void drawRect(int x, int y, unsigned width, unsigned height, uint8_t r = 0,
 	uint8_t g = 0, uint8_t b = 0, unsigned thickness = 1);
 void fillRect(int x, int y, unsigned width, unsigned height, uint8_t r = 0,
@@ -60,6 +75,25 @@ void clearScreen(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0);
 void setClipRegion(int x, int y, unsigned width, unsigned height);
 void unsetClipRegion(void);
 
+// Save the next finished frame into QOI image file
+void captureScreenshot(const char *filename);
+// Record all finished frames into file until stopRecording() is called.
+// Files are written in a background thread.
+void startRecording(const char *filename);
+void stopRecording(void);
+int isRecording(void);
+
+// Write all input events and frame ticks handled by main_loop() into file
+void recordInput(const char *filename);
+// Feed recorded input into main_loop() instead of live events and print
+// per-view frame times at the end. Headless replay runs as fast as possible.
+void replayInput(const char *filename, int headless);
+
+// Mouse positions merged into the mouse move event being handled, oldest
+// first. The coords array contains x, y for each position. Widgets which
+// need every point of a drag can call this from handleMouseMove().
+unsigned getMouseMotionHistory(const int **coords);
+
 // Main event loop
 void main_loop(void);
 
@@ -0,0 +1,145 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstring>
+#include <SDL.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_INTRINSICS
+#endif
+
+#include "sdl_blit.h"
+
+blit_func opaque_blit = NULL, binary_blit = NULL;
+static uint32_t blit_amask = 0;
+
+static void blitOpaque(const uint32_t *src, unsigned srcpitch, uint32_t *dst,
+	unsigned dstpitch, unsigned width, unsigned height) {
+
+	for (; height; height--, src += srcpitch, dst += dstpitch) {
+		memcpy(dst, src, width * sizeof(uint32_t));
+	}
+}
+
+// Every pixel is either fully transparent or fully opaque
+static void blitBinary(const uint32_t *src, unsigned srcpitch, uint32_t *dst,
+	unsigned dstpitch, unsigned width, unsigned height) {
+
+	unsigned i;
+
+	for (; height; height--, src += srcpitch, dst += dstpitch) {
+		for (i = 0; i < width; i++) {
+			if (src[i] & blit_amask) {
+				dst[i] = src[i];
+			}
+		}
+	}
+}
+
+#ifdef HAVE_X86_INTRINSICS
+__attribute__((target("sse2")))
+static void blitBinarySSE2(const uint32_t *src, unsigned srcpitch,
+	uint32_t *dst, unsigned dstpitch, unsigned width, unsigned height) {
+
+	unsigned i;
+	__m128i s, d, mask, alpha = _mm_set1_epi32(blit_amask);
+	__m128i zero = _mm_setzero_si128();
+
+	for (; height; height--, src += srcpitch, dst += dstpitch) {
+		for (i = 0; i + 4 <= width; i += 4) {
+			s = _mm_loadu_si128((const __m128i*)(src + i));
+			d = _mm_loadu_si128((const __m128i*)(dst + i));
+			mask = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+			d = _mm_or_si128(_mm_and_si128(mask, d),
+				_mm_andnot_si128(mask, s));
+			_mm_storeu_si128((__m128i*)(dst + i), d);
+		}
+
+		for (; i < width; i++) {
+			if (src[i] & blit_amask) {
+				dst[i] = src[i];
+			}
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void blitBinaryAVX2(const uint32_t *src, unsigned srcpitch,
+	uint32_t *dst, unsigned dstpitch, unsigned width, unsigned height) {
+
+	unsigned i;
+	__m256i s, d, mask, alpha = _mm256_set1_epi32(blit_amask);
+	__m256i zero = _mm256_setzero_si256();
+
+	for (; height; height--, src += srcpitch, dst += dstpitch) {
+		for (i = 0; i + 8 <= width; i += 8) {
+			s = _mm256_loadu_si256((const __m256i*)(src + i));
+			d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			mask = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha),
+				zero);
+			d = _mm256_blendv_epi8(s, d, mask);
+			_mm256_storeu_si256((__m256i*)(dst + i), d);
+		}
+
+		for (; i < width; i++) {
+			if (src[i] & blit_amask) {
+				dst[i] = src[i];
+			}
+		}
+	}
+}
+#endif
+
+void initBlitFunctions(uint32_t alphamask) {
+	blit_amask = alphamask;
+	opaque_blit = blitOpaque;
+	binary_blit = blitBinary;
+
+#ifdef HAVE_X86_INTRINSICS
+	if (SDL_HasAVX2()) {
+		binary_blit = blitBinaryAVX2;
+	} else if (SDL_HasSSE2()) {
+		binary_blit = blitBinarySSE2;
+	}
+#endif
+}
+
+unsigned binaryBlitKernels(BlitKernel *list, unsigned size) {
+	unsigned count = 0;
+
+	if (count < size) {
+		list[count].name = "C";
+		list[count++].func = blitBinary;
+	}
+
+#ifdef HAVE_X86_INTRINSICS
+	if (count < size && SDL_HasSSE2()) {
+		list[count].name = "SSE2";
+		list[count++].func = blitBinarySSE2;
+	}
+
+	if (count < size && SDL_HasAVX2()) {
+		list[count].name = "AVX2";
+		list[count++].func = blitBinaryAVX2;
+	}
+#endif
+
+	return count;
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef SDL_BLIT_H_
+#define SDL_BLIT_H_
+
+#include <cstdint>
+
+// Copy width x height pixels from src to dst, pitch is in pixels
+typedef void (*blit_func)(const uint32_t *src, unsigned srcpitch,
+	uint32_t *dst, unsigned dstpitch, unsigned width, unsigned height);
+
+struct BlitKernel {
+	const char *name;
+	blit_func func;
+};
+
+// Blit kernels for 32-bit pixels with given alpha channel mask. Every pixel
+// must be opaque for opaque_blit. For binary_blit, every pixel must be either
+// fully transparent or fully opaque. Other textures need SDL blending.
+extern blit_func opaque_blit, binary_blit;
+
+// Set alpha channel mask and pick the fastest kernels for this CPU
+void initBlitFunctions(uint32_t alphamask);
+
+// List binary alpha kernels supported by this CPU, slowest first. Returns
+// the number of kernels written to the list.
+unsigned binaryBlitKernels(BlitKernel *list, unsigned size);
+
+#endif
@@ -0,0 +1,477 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include "stream.h"
+#include "utils.h"
+#include "screen.h"
+#include "sdl_capture.h"
+
+#define CAPTURE_POOL_SIZE 8
+#define CAPTURE_QUEUE_SIZE 16
+#define CAPTURE_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+#define QOI_MAGIC "qoif"
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_MAX_RUN 62
+
+// Recording file format:
+// - magic, uint16 width, uint16 height
+// - for each frame: uint32 timestamp, uint32 span count and the spans.
+//   Each span is uint32 count of pixels unchanged since the previous frame,
+//   uint32 count of changed pixels and the changed pixels as RGB triplets.
+#define RECORDING_MAGIC "OO2R"
+
+enum CaptureJobType {
+	CAPTURE_STILL = 0,
+	CAPTURE_FRAME,
+	CAPTURE_STOP
+};
+
+struct CaptureJob {
+	unsigned type, timestamp;
+	uint32_t *pixels;
+	char *filename;
+	File *file;
+};
+
+const SDL_PixelFormat *capture_format = NULL;
+uint32_t *capture_pool[CAPTURE_POOL_SIZE];
+unsigned capture_free = 0, capture_allocated = 0;
+CaptureJob capture_queue[CAPTURE_QUEUE_SIZE];
+unsigned queue_start = 0, queue_length = 0, dropped_frames = 0;
+char *pending_still = NULL;
+File *recording = NULL;
+
+SDL_Thread *capture_worker = NULL;
+SDL_mutex *capture_mutex = NULL;
+SDL_cond *capture_start = NULL, *capture_done = NULL;
+int capture_quit = 0;
+
+// Encoder thread state
+uint32_t *prev_frame = NULL;
+
+static void allocatePool(void) {
+	for (; capture_allocated < CAPTURE_POOL_SIZE; capture_allocated++) {
+		capture_pool[capture_free++] = new uint32_t[CAPTURE_PIXELS];
+	}
+}
+
+// Caller must hold capture_mutex
+static void pushJob(const CaptureJob &job) {
+	unsigned pos = (queue_start + queue_length) % CAPTURE_QUEUE_SIZE;
+
+	capture_queue[pos] = job;
+	queue_length++;
+	SDL_CondSignal(capture_start);
+}
+
+static void writePixel(WriteStream &stream, uint32_t pixel) {
+	stream.writeUint8((pixel & capture_format->Rmask) >>
+		capture_format->Rshift);
+	stream.writeUint8((pixel & capture_format->Gmask) >>
+		capture_format->Gshift);
+	stream.writeUint8((pixel & capture_format->Bmask) >>
+		capture_format->Bshift);
+}
+
+static void writeQOI(const char *filename, const uint32_t *pixels) {
+	unsigned i, idx, run = 0;
+	int dr, dg, db;
+	uint32_t px, prev = 0, index[64];
+	uint8_t r, g, b, pr = 0, pg = 0, pb = 0;
+	uint32_t rgbmask = capture_format->Rmask | capture_format->Gmask |
+		capture_format->Bmask;
+	MemoryWriteStream buf(CAPTURE_PIXELS);
+	File fw;
+
+	// Masked pixels never match this value
+	memset(index, 0xff, sizeof(index));
+	buf.write(QOI_MAGIC, 4);
+	buf.writeUint32BE(SCREEN_WIDTH);
+	buf.writeUint32BE(SCREEN_HEIGHT);
+	buf.writeUint8(3);
+	buf.writeUint8(0);
+
+	for (i = 0; i < CAPTURE_PIXELS; i++) {
+		px = pixels[i] & rgbmask;
+
+		if (px == prev) {
+			run++;
+
+			if (run == QOI_MAX_RUN || i == CAPTURE_PIXELS - 1) {
+				buf.writeUint8(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			continue;
+		}
+
+		if (run) {
+			buf.writeUint8(QOI_OP_RUN | (run - 1));
+			run = 0;
+		}
+
+		r = (px & capture_format->Rmask) >> capture_format->Rshift;
+		g = (px & capture_format->Gmask) >> capture_format->Gshift;
+		b = (px & capture_format->Bmask) >> capture_format->Bshift;
+		idx = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+		prev = px;
+
+		if (index[idx] == px) {
+			buf.writeUint8(QOI_OP_INDEX | idx);
+			pr = r;
+			pg = g;
+			pb = b;
+			continue;
+		}
+
+		index[idx] = px;
+		dr = (int8_t)(r - pr);
+		dg = (int8_t)(g - pg);
+		db = (int8_t)(b - pb);
+		pr = r;
+		pg = g;
+		pb = b;
+
+		if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+			db <= 1) {
+			buf.writeUint8(QOI_OP_DIFF | (dr + 2) << 4 |
+				(dg + 2) << 2 | (db + 2));
+		} else if (dg >= -32 && dg <= 31 && dr - dg >= -8 &&
+			dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+			buf.writeUint8(QOI_OP_LUMA | (dg + 32));
+			buf.writeUint8((dr - dg + 8) << 4 | (db - dg + 8));
+		} else {
+			buf.writeUint8(QOI_OP_RGB);
+			buf.writeUint8(r);
+			buf.writeUint8(g);
+			buf.writeUint8(b);
+		}
+	}
+
+	// End marker
+	buf.writeUint32BE(0);
+	buf.writeUint32BE(1);
+
+	if (!fw.open(filename, File::WRITE | File::TRUNCATE)) {
+		throw std::runtime_error("Cannot create screenshot file");
+	}
+
+	if (fw.write(buf.dataPtr(), buf.size()) != buf.size()) {
+		throw std::runtime_error("Cannot write screenshot file");
+	}
+}
+
+static void writeDeltaFrame(File *file, unsigned timestamp,
+	const uint32_t *pixels) {
+
+	unsigned i, start, last = 0, spans = 0;
+	uint32_t rgbmask = capture_format->Rmask | capture_format->Gmask |
+		capture_format->Bmask;
+	MemoryWriteStream buf;
+
+	for (i = 0; i < CAPTURE_PIXELS;) {
+		for (; i < CAPTURE_PIXELS &&
+			!((pixels[i] ^ prev_frame[i]) & rgbmask); i++);
+
+		if (i >= CAPTURE_PIXELS) {
+			break;
+		}
+
+		for (start = i; i < CAPTURE_PIXELS &&
+			((pixels[i] ^ prev_frame[i]) & rgbmask); i++);
+
+		buf.writeUint32LE(start - last);
+		buf.writeUint32LE(i - start);
+
+		for (; start < i; start++) {
+			writePixel(buf, pixels[start]);
+		}
+
+		last = i;
+		spans++;
+	}
+
+	file->writeUint32LE(timestamp);
+	file->writeUint32LE(spans);
+
+	if (file->write(buf.dataPtr(), buf.size()) != buf.size()) {
+		throw std::runtime_error("Cannot write recording file");
+	}
+
+	memcpy(prev_frame, pixels, CAPTURE_PIXELS * sizeof(uint32_t));
+}
+
+static void encodeJob(const CaptureJob &job) {
+	switch (job.type) {
+	case CAPTURE_STILL:
+		writeQOI(job.filename, job.pixels);
+		break;
+
+	case CAPTURE_FRAME:
+		if (!prev_frame) {
+			prev_frame = new uint32_t[CAPTURE_PIXELS];
+			memset(prev_frame, 0, CAPTURE_PIXELS * sizeof(uint32_t));
+		}
+
+		writeDeltaFrame(job.file, job.timestamp, job.pixels);
+		break;
+
+	case CAPTURE_STOP:
+		delete job.file;
+		delete[] prev_frame;
+		prev_frame = NULL;
+		break;
+	}
+}
+
+static int captureWorker(void *arg) {
+	CaptureJob job;
+
+	SDL_LockMutex(capture_mutex);
+
+	while (1) {
+		while (!capture_quit && !queue_length) {
+			SDL_CondWait(capture_start, capture_mutex);
+		}
+
+		// Finish all queued jobs before exiting
+		if (!queue_length) {
+			break;
+		}
+
+		job = capture_queue[queue_start];
+		queue_start = (queue_start + 1) % CAPTURE_QUEUE_SIZE;
+		queue_length--;
+		SDL_UnlockMutex(capture_mutex);
+
+		try {
+			encodeJob(job);
+		} catch (std::exception &e) {
+			fprintf(stderr, "Frame capture error: %s\n", e.what());
+		}
+
+		delete[] job.filename;
+		SDL_LockMutex(capture_mutex);
+
+		if (job.pixels) {
+			capture_pool[capture_free++] = job.pixels;
+		}
+
+		SDL_CondSignal(capture_done);
+	}
+
+	SDL_UnlockMutex(capture_mutex);
+	return 0;
+}
+
+void initCapture(const SDL_PixelFormat *format) {
+	if (format->BytesPerPixel != 4) {
+		throw std::invalid_argument("Unsupported capture pixel format");
+	}
+
+	capture_format = format;
+	capture_mutex = SDL_CreateMutex();
+	capture_start = SDL_CreateCond();
+	capture_done = SDL_CreateCond();
+
+	if (!capture_mutex || !capture_start || !capture_done) {
+		throw std::runtime_error("Cannot initialize frame capture");
+	}
+
+	capture_worker = SDL_CreateThread(captureWorker, "capture", NULL);
+
+	if (!capture_worker) {
+		throw std::runtime_error("Cannot start frame capture thread");
+	}
+}
+
+void shutdownCapture(void) {
+	unsigned i;
+
+	if (capture_worker) {
+		stopRecording();
+		SDL_LockMutex(capture_mutex);
+		capture_quit = 1;
+		SDL_CondSignal(capture_start);
+		SDL_UnlockMutex(capture_mutex);
+		SDL_WaitThread(capture_worker, NULL);
+		capture_worker = NULL;
+	}
+
+	if (capture_done) {
+		SDL_DestroyCond(capture_done);
+	}
+
+	if (capture_start) {
+		SDL_DestroyCond(capture_start);
+	}
+
+	if (capture_mutex) {
+		SDL_DestroyMutex(capture_mutex);
+	}
+
+	for (i = 0; i < capture_free; i++) {
+		delete[] capture_pool[i];
+	}
+
+	if (dropped_frames) {
+		fprintf(stderr, "Frame capture dropped %u frames\n",
+			dropped_frames);
+	}
+
+	delete[] pending_still;
+	pending_still = NULL;
+	capture_done = capture_start = NULL;
+	capture_mutex = NULL;
+	capture_free = capture_allocated = 0;
+}
+
+void captureFrame(const SDL_Surface *surf) {
+	int y;
+	unsigned i, count, timestamp;
+	uint32_t *buffers[2];
+	const uint8_t *src;
+	CaptureJob job = {CAPTURE_STILL, 0, NULL, NULL, NULL};
+
+	if (!pending_still && !recording) {
+		return;
+	}
+
+	timestamp = SDL_GetTicks();
+	SDL_LockMutex(capture_mutex);
+
+	// Each job needs its own buffer because the encoder owns it
+	count = (pending_still ? 1 : 0) + (recording ? 1 : 0);
+
+	if (count > capture_free ||
+		queue_length + count > CAPTURE_QUEUE_SIZE) {
+		dropped_frames++;
+		SDL_UnlockMutex(capture_mutex);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		buffers[i] = capture_pool[--capture_free];
+	}
+
+	SDL_UnlockMutex(capture_mutex);
+
+	for (y = 0, src = (const uint8_t*)surf->pixels; y < SCREEN_HEIGHT;
+		y++, src += surf->pitch) {
+		memcpy(buffers[0] + y * SCREEN_WIDTH, src,
+			SCREEN_WIDTH * sizeof(uint32_t));
+	}
+
+	if (count > 1) {
+		memcpy(buffers[1], buffers[0],
+			CAPTURE_PIXELS * sizeof(uint32_t));
+	}
+
+	SDL_LockMutex(capture_mutex);
+	job.timestamp = timestamp;
+	i = 0;
+
+	if (pending_still) {
+		job.pixels = buffers[i++];
+		job.filename = pending_still;
+		pending_still = NULL;
+		pushJob(job);
+	}
+
+	if (recording) {
+		job.type = CAPTURE_FRAME;
+		job.pixels = buffers[i];
+		job.filename = NULL;
+		job.file = recording;
+		pushJob(job);
+	}
+
+	SDL_UnlockMutex(capture_mutex);
+}
+
+void captureScreenshot(const char *filename) {
+	char *tmp;
+
+	if (!capture_worker) {
+		throw std::logic_error("Frame capture is not initialized");
+	}
+
+	allocatePool();
+	tmp = copystr(filename);
+	delete[] pending_still;
+	pending_still = tmp;
+}
+
+void startRecording(const char *filename) {
+	File *fw;
+
+	if (!capture_worker) {
+		throw std::logic_error("Frame capture is not initialized");
+	}
+
+	stopRecording();
+	allocatePool();
+	fw = new File;
+
+	try {
+		if (!fw->open(filename, File::WRITE | File::TRUNCATE)) {
+			throw std::runtime_error("Cannot create recording file");
+		}
+
+		fw->write(RECORDING_MAGIC, 4);
+		fw->writeUint16LE(SCREEN_WIDTH);
+		fw->writeUint16LE(SCREEN_HEIGHT);
+	} catch (...) {
+		delete fw;
+		throw;
+	}
+
+	recording = fw;
+}
+
+void stopRecording(void) {
+	CaptureJob job = {CAPTURE_STOP, 0, NULL, NULL, NULL};
+
+	if (!recording) {
+		return;
+	}
+
+	SDL_LockMutex(capture_mutex);
+
+	// The stop job must not be dropped, wait for free queue slot
+	while (queue_length >= CAPTURE_QUEUE_SIZE) {
+		SDL_CondWait(capture_done, capture_mutex);
+	}
+
+	job.file = recording;
+	pushJob(job);
+	SDL_UnlockMutex(capture_mutex);
+	recording = NULL;
+}
+
+int isRecording(void) {
+	return recording != NULL;
+}
@@ -0,0 +1,33 @@
+/*
+ * This file is part of OpenOrion2
+ * Copyright (C) 2021 Martin Doucha
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef SDL_CAPTURE_H_
+#define SDL_CAPTURE_H_
+
+#include <SDL.h>
+
+// Screen backend hooks for frame capture, see captureScreenshot()
+void initCapture(const SDL_PixelFormat *format);
+void shutdownCapture(void);
+
+// Queue finished frame for encoding if a capture was requested.
+// Never blocks, frames are dropped when the encoder falls behind.
+void captureFrame(const SDL_Surface *surf);
+
+#endif
@@ -17,9 +17,32 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
 #include <SDL.h>
+#include "system.h"
 #include "gui.h"
 #include "screen.h"
+#include "profiler.h"
+#include "inputlog.h"
+
+#define MOTION_HISTORY 64
+
+// Replay frame times are grouped by consecutive frames of the same view
+struct ViewTiming {
+	const char *name;
+	unsigned frames;
+	uint64_t total, max;
+};
+
+InputRecorder *input_recorder = NULL;
+InputReplay *input_replay = NULL;
+int headless_replay = 0;
+ViewTiming *view_timings = NULL;
+size_t timing_count = 0, timing_max = 0;
+int motion_history[2 * MOTION_HISTORY];
+unsigned motion_count = 0;
 
 unsigned buttonState(unsigned sdlButtons) {
 	unsigned ret = 0;
@@ -52,9 +75,315 @@ unsigned convertButton(unsigned sdlButton) {
 	}
 }
 
-void main_loop(void) {
+// F12 saves screenshot, F11 starts or stops recording
+void handleCaptureKey(SDL_Keycode key) {
+	time_t now = time(NULL);
+	char *path;
+	StringBuffer buf;
+
+	if (key == SDLK_F11 && isRecording()) {
+		stopRecording();
+		return;
+	}
+
+	if (key != SDLK_F11 && key != SDLK_F12) {
+		return;
+	}
+
+	buf.printf(key == SDLK_F11 ? "recording-" : "screenshot-");
+	buf.append_ftime("%Y%m%d-%H%M%S", localtime(&now));
+	buf.append(key == SDLK_F11 ? ".rec" : ".qoi");
+	path = configPath(buf.c_str());
+
+	try {
+		if (key == SDLK_F11) {
+			startRecording(path);
+		} else {
+			captureScreenshot(path);
+		}
+	} catch (std::exception &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+	}
+
+	delete[] path;
+}
+
+// F10 toggles profiler overlay, F9 starts or stops trace recording
+void handleProfilerKey(SDL_Keycode key) {
+	time_t now = time(NULL);
+	char *path;
+	StringBuffer buf;
+
+	if (key == SDLK_F10) {
+		enableProfiler(!profiler_enabled);
+		return;
+	}
+
+	if (key != SDLK_F9) {
+		return;
+	}
+
+	if (!isProfileTracing()) {
+		enableProfiler(1);
+		startProfileTrace();
+		return;
+	}
+
+	buf.printf("trace-");
+	buf.append_ftime("%Y%m%d-%H%M%S", localtime(&now));
+	buf.append(".json");
+	path = configPath(buf.c_str());
+
+	try {
+		stopProfileTrace(path);
+	} catch (std::exception &e) {
+		fprintf(stderr, "Error: %s\n", e.what());
+	}
+
+	delete[] path;
+}
+
+void addMotionHistory(int x, int y) {
+	// Keep the newer half of the history on overflow
+	if (motion_count >= MOTION_HISTORY) {
+		memmove(motion_history, motion_history + MOTION_HISTORY,
+			MOTION_HISTORY * sizeof(int));
+		motion_count = MOTION_HISTORY / 2;
+	}
+
+	motion_history[2 * motion_count] = x;
+	motion_history[2 * motion_count + 1] = y;
+	motion_count++;
+}
+
+unsigned getMouseMotionHistory(const int **coords) {
+	*coords = motion_history;
+	return motion_count;
+}
+
+// Convert SDL event to input event for views, returns 0 if the event
+// should not be dispatched to views
+int convertEvent(const SDL_Event &ev, InputEvent &ret) {
+	ret.x = ret.y = 0;
+	ret.arg = 0;
+
+	switch (ev.type) {
+	case SDL_QUIT:
+		ret.type = INPUT_QUIT;
+		return 1;
+
+	case SDL_MOUSEMOTION:
+		ret.type = INPUT_MOUSE_MOVE;
+		ret.x = ev.motion.x;
+		ret.y = ev.motion.y;
+		ret.arg = buttonState(ev.motion.state);
+		break;
+
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		ret.type = ev.type == SDL_MOUSEBUTTONDOWN ? INPUT_MOUSE_DOWN :
+			INPUT_MOUSE_UP;
+		ret.x = ev.button.x;
+		ret.y = ev.button.y;
+		ret.arg = convertButton(ev.button.button);
+		break;
+
+	case SDL_KEYDOWN:
+		if (ev.key.repeat) {
+			return 0;
+		}
+
+		ret.type = INPUT_KEY_DOWN;
+		ret.arg = ev.key.keysym.sym;
+		return 1;
+
+	default:
+		return 0;
+	}
+
+	return isInRect(ret.x, ret.y, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+// Returns 0 if the game should quit
+int dispatchEvent(GuiView *view, const InputEvent &ev) {
+	if (input_recorder) {
+		input_recorder->write(ev);
+	}
+
+	switch (ev.type) {
+	case INPUT_QUIT:
+		view->close();
+		gui_stack->clear();
+		return 0;
+
+	case INPUT_MOUSE_MOVE:
+		// Replayed moves have no history
+		if (!motion_count) {
+			addMotionHistory(ev.x, ev.y);
+		}
+
+		view->handleMouseMove(ev.x, ev.y, ev.arg);
+		motion_count = 0;
+		break;
+
+	case INPUT_MOUSE_DOWN:
+		view->handleMouseDown(ev.x, ev.y, ev.arg);
+		break;
+
+	case INPUT_MOUSE_UP:
+		view->handleMouseUp(ev.x, ev.y, ev.arg);
+		break;
+
+	case INPUT_KEY_DOWN:
+		handleCaptureKey(ev.arg);
+		handleProfilerKey(ev.arg);
+		break;
+	}
+
+	return 1;
+}
+
+// Consecutive mouse moves are merged into one event with the latest
+// position. Any other event flushes the pending move first to keep order.
+int pollEvents(GuiView *view) {
+	SDL_Event ev;
+	InputEvent iev, motion;
+	int pending = 0;
+
+	while (SDL_PollEvent(&ev)) {
+		if (ev.type == SDL_WINDOWEVENT &&
+			ev.window.event == SDL_WINDOWEVENT_EXPOSED) {
+			redrawScreen();
+			continue;
+		}
+
+		if (!convertEvent(ev, iev)) {
+			continue;
+		}
+
+		if (iev.type == INPUT_MOUSE_MOVE) {
+			motion = iev;
+			pending = 1;
+			addMotionHistory(iev.x, iev.y);
+			continue;
+		}
+
+		if (pending) {
+			pending = 0;
+
+			if (!dispatchEvent(view, motion)) {
+				return 0;
+			}
+		}
+
+		if (!dispatchEvent(view, iev)) {
+			return 0;
+		}
+	}
+
+	return !pending || dispatchEvent(view, motion);
+}
+
+// Dispatch recorded events until the end of the next frame
+int replayEvents(GuiView *view, unsigned *tick) {
 	SDL_Event ev;
+	InputEvent iev;
+
+	// Live input is ignored during replay except for closing the window
+	while (SDL_PollEvent(&ev)) {
+		if (ev.type == SDL_QUIT) {
+			iev.type = INPUT_QUIT;
+			return dispatchEvent(view, iev);
+		}
+	}
+
+	while (input_replay->read(iev)) {
+		if (iev.type == INPUT_FRAME) {
+			*tick = iev.arg;
+			return 1;
+		}
+
+		if (!dispatchEvent(view, iev)) {
+			return 0;
+		}
+	}
+
+	view->close();
+	gui_stack->clear();
+	return 0;
+}
+
+void addViewTiming(GuiView *view, uint64_t duration) {
+	ViewTiming *tmp;
+	const char *name = view->name();
+
+	if (!timing_count || view_timings[timing_count - 1].name != name) {
+		if (timing_count >= timing_max) {
+			size_t size = timing_max ? 2 * timing_max : 16;
+
+			tmp = new ViewTiming[size];
+			memcpy(tmp, view_timings,
+				timing_count * sizeof(ViewTiming));
+			delete[] view_timings;
+			view_timings = tmp;
+			timing_max = size;
+		}
+
+		tmp = view_timings + timing_count++;
+		tmp->name = name;
+		tmp->frames = 0;
+		tmp->total = tmp->max = 0;
+	}
+
+	tmp = view_timings + timing_count - 1;
+	tmp->frames++;
+	tmp->total += duration;
+	tmp->max = MAX(tmp->max, duration);
+}
+
+void printViewTimings(void) {
+	size_t i;
+	unsigned frames = 0;
+	uint64_t total = 0;
+	const ViewTiming *ptr;
+
+	printf("Frame times per view (ms):\n");
+
+	for (i = 0, ptr = view_timings; i < timing_count; i++, ptr++) {
+		printf("  %-24s %6u frames  total %9.2f  avg %6.3f  max %6.3f\n",
+			ptr->name, ptr->frames, ptr->total / 1000.0,
+			ptr->total / 1000.0 / ptr->frames, ptr->max / 1000.0);
+		frames += ptr->frames;
+		total += ptr->total;
+	}
+
+	if (frames) {
+		printf("Total: %u frames in %.2f ms, avg %.3f ms\n", frames,
+			total / 1000.0, total / 1000.0 / frames);
+	}
+}
+
+void recordInput(const char *filename) {
+	InputRecorder *tmp = new InputRecorder(filename);
+
+	delete input_recorder;
+	input_recorder = tmp;
+}
+
+void replayInput(const char *filename, int headless) {
+	InputReplay *tmp = new InputReplay(filename);
+
+	delete input_replay;
+	input_replay = tmp;
+	headless_replay = headless;
+}
+
+void main_loop(void) {
 	GuiView *view, *prev_view = NULL;
+	unsigned tick, first_tick = 0, real_start = SDL_GetTicks();
+	uint64_t frame_start;
+	InputEvent iev = {INPUT_FRAME, 0, 0, 0};
+	int first_frame = 1;
 
 	while (!gui_stack->is_empty()) {
 		view = gui_stack->top();
@@ -73,56 +402,63 @@ void main_loop(void) {
 
 		GarbageCollector::flush();
 
-		while (SDL_PollEvent(&ev)) {
-			switch (ev.type) {
-			case SDL_QUIT:
-				view->close();
-				gui_stack->clear();
-				return;
-
-			case SDL_MOUSEMOTION:
-				if (!isInRect(ev.motion.x, ev.motion.y, 0, 0,
-					SCREEN_WIDTH, SCREEN_HEIGHT)) {
-					break;
-				}
-
-				view->handleMouseMove(ev.motion.x, ev.motion.y,
-					buttonState(ev.motion.state));
+		if (input_replay) {
+			if (!replayEvents(view, &tick)) {
 				break;
-
-			case SDL_MOUSEBUTTONDOWN:
-				if (!isInRect(ev.button.x, ev.button.y, 0, 0,
-					SCREEN_WIDTH, SCREEN_HEIGHT)) {
-					break;
-				}
-
-				view->handleMouseDown(ev.button.x, ev.button.y,
-					convertButton(ev.button.button));
+			}
+		} else {
+			if (!pollEvents(view)) {
 				break;
+			}
 
-			case SDL_MOUSEBUTTONUP:
-				if (!isInRect(ev.button.x, ev.button.y, 0, 0,
-					SCREEN_WIDTH, SCREEN_HEIGHT)) {
-					break;
-				}
+			tick = SDL_GetTicks();
+		}
 
-				view->handleMouseUp(ev.button.x, ev.button.y,
-					convertButton(ev.button.button));
-				break;
+		if (input_recorder) {
+			iev.arg = tick;
+			input_recorder->write(iev);
+		}
 
-			case SDL_WINDOWEVENT:
-				switch (ev.window.event) {
-				case SDL_WINDOWEVENT_EXPOSED:
-					redrawScreen();
-					break;
-				}
+		frame_start = profileTime();
 
-				break;
-			}
+		{
+			PROFILE_SCOPE("redraw");
+			view->redraw(tick);
 		}
 
-		view->redraw(SDL_GetTicks());
+		drawProfileOverlay();
 		updateScreen();
-		SDL_Delay(10);
+		profileFrameEnd();
+
+		if (!input_replay) {
+			SDL_Delay(10);
+			continue;
+		}
+
+		addViewTiming(view, profileTime() - frame_start);
+
+		if (first_frame) {
+			first_tick = tick;
+			first_frame = 0;
+		}
+
+		// Replay at the recorded speed unless running headless
+		if (!headless_replay && tick - first_tick >
+			SDL_GetTicks() - real_start) {
+			SDL_Delay(tick - first_tick -
+				(SDL_GetTicks() - real_start));
+		}
+	}
+
+	if (input_replay) {
+		printViewTimings();
 	}
+
+	delete input_recorder;
+	delete input_replay;
+	delete[] view_timings;
+	input_recorder = NULL;
+	input_replay = NULL;
+	view_timings = NULL;
+	timing_count = timing_max = 0;
 }
@@ -19,12 +19,56 @@
 
 #include <SDL.h>
 #include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_INTRINSICS
+#endif
+
+#include "utils.h"
 #include "screen.h"
+#include "profiler.h"
+#include "sdl_blit.h"
+#include "sdl_capture.h"
 
 #define WINDOW_TITLE "OpenOrion2"
+#define MAX_RENDER_THREADS 8
+
+// Damage tracking grid for retained mode
+#define REGION_COLS 8
+#define REGION_ROWS 8
+#define REGION_COUNT (REGION_COLS * REGION_ROWS)
+#define REGION_WIDTH (SCREEN_WIDTH / REGION_COLS)
+#define REGION_HEIGHT (SCREEN_HEIGHT / REGION_ROWS)
+#define HASH_SEED 0xcbf29ce484222325ULL
+#define HASH_PRIME 0x100000001b3ULL
 
 struct Texture {
 	SDL_Surface *palsurf, *drawsurf;
+	// Specialized blit for textures without partial transparency,
+	// NULL means SDL_LowerBlit() must be used
+	blit_func blit;
+	// Extra surface headers sharing drawsurf pixels, one per render band
+	// except the first. SDL blits keep state in the source surface so
+	// each band thread needs its own copy.
+	SDL_Surface **bandsurfs;
+	// Changes whenever the texture contents change
+	unsigned serial;
+};
+
+enum DrawCommandType {
+	DRAW_TEXTURE = 0,
+	DRAW_LINE,
+	DRAW_FILL,
+	DRAW_CLIP,
+	DRAW_UNCLIP
+};
+
+// DRAW_LINE stores the start point in src.x/src.y, end point in dst.x/dst.y
+struct DrawCommand {
+	unsigned type, texture;
+	uint32_t color;
+	SDL_Rect src, dst;
 };
 
 SDL_Window *window = NULL;
@@ -34,6 +78,35 @@ SDL_Surface *drawbuffer = NULL;
 Texture *textures = NULL;
 size_t texture_count = 0, texture_max = 0;
 uint32_t amask = 0, rmask = 0, gmask = 0, bmask = 0;
+uint32_t texture_format = 0;
+
+DrawCommand *draw_commands = NULL;
+size_t command_count = 0, command_max = 0;
+SDL_Rect command_clip = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+int command_clip_active = 0;
+
+SDL_Thread *render_workers[MAX_RENDER_THREADS];
+SDL_mutex *render_mutex = NULL;
+SDL_cond *render_start = NULL, *render_done = NULL;
+unsigned render_threads = 1, render_generation = 0, render_pending = 0;
+int render_quit = 0;
+
+// Software renderer upscaling, see presentScaled()
+SDL_Texture *scaledbuffer = NULL;
+uint32_t *present_buffer = NULL;
+void *present_pixels = NULL;
+SDL_Thread *present_worker = NULL;
+SDL_mutex *present_mutex = NULL;
+SDL_cond *present_start = NULL, *present_done = NULL;
+unsigned present_scale = 1;
+int present_pitch = 0, present_busy = 0, present_quit = 0, present_ready = 0;
+int software_renderer = 0, has_sse2 = 0;
+
+uint64_t region_hashes[REGION_COUNT], prev_region_hashes[REGION_COUNT];
+char dirty_regions[REGION_COUNT];
+unsigned texture_serial = 0;
+int retained_mode = 0, full_redraw = 1;
+int headless_screen = 0;
 
 static void resizeTextureRegistry(void) {
 	Texture *tmp;
@@ -47,10 +120,901 @@ static void resizeTextureRegistry(void) {
 	texture_max = size;
 }
 
-void initScreen(void) {
+// Pick the fastest blit function which gives the same result as SDL blending
+static blit_func selectBlitFunction(SDL_Surface *surf) {
+	int x, y, opaque = 1;
+	uint32_t alpha, *ptr;
+
+	if (surf->format->format != texture_format) {
+		return NULL;
+	}
+
+	for (y = 0; y < surf->h; y++) {
+		ptr = (uint32_t*)((uint8_t*)surf->pixels + y * surf->pitch);
+
+		for (x = 0; x < surf->w; x++) {
+			alpha = ptr[x] & amask;
+
+			if (alpha && alpha != amask) {
+				return NULL;
+			}
+
+			opaque = opaque && alpha;
+		}
+	}
+
+	return opaque ? opaque_blit : binary_blit;
+}
+
+static void freeBandSurfaces(Texture *tex) {
+	unsigned i;
+
+	if (!tex->bandsurfs) {
+		return;
+	}
+
+	for (i = 0; i < render_threads - 1; i++) {
+		if (tex->bandsurfs[i]) {
+			SDL_FreeSurface(tex->bandsurfs[i]);
+		}
+	}
+
+	delete[] tex->bandsurfs;
+	tex->bandsurfs = NULL;
+}
+
+static void prepareBandSurfaces(Texture *tex) {
+	unsigned i;
+	SDL_Surface *surf = tex->drawsurf;
+	SDL_BlendMode mode;
+	SDL_Rect empty = {0, 0, 0, 0};
+
+	if (tex->blit || tex->bandsurfs || render_threads < 2) {
+		return;
+	}
+
+	tex->bandsurfs = new SDL_Surface*[render_threads - 1];
+	memset(tex->bandsurfs, 0, (render_threads - 1) * sizeof(SDL_Surface*));
+	SDL_GetSurfaceBlendMode(surf, &mode);
+
+	for (i = 0; i < render_threads - 1; i++) {
+		tex->bandsurfs[i] = SDL_CreateRGBSurfaceWithFormatFrom(
+			surf->pixels, surf->w, surf->h,
+			surf->format->BitsPerPixel, surf->pitch,
+			surf->format->format);
+
+		if (!tex->bandsurfs[i]) {
+			freeBandSurfaces(tex);
+			throw std::runtime_error("Cannot allocate band surface");
+		}
+
+		SDL_SetSurfaceBlendMode(tex->bandsurfs[i], mode);
+		// Build the blit mapping now, it's not thread safe
+		SDL_LowerBlit(tex->bandsurfs[i], &empty, drawbuffer, &empty);
+	}
+}
+
+static void appendCommand(const DrawCommand &cmd) {
+	DrawCommand *tmp;
+
+	if (command_count >= command_max) {
+		tmp = new DrawCommand[2 * command_max];
+		memcpy(tmp, draw_commands, command_count * sizeof(DrawCommand));
+		delete[] draw_commands;
+		draw_commands = tmp;
+		command_max *= 2;
+	}
+
+	draw_commands[command_count++] = cmd;
+}
+
+// Clip blit source rectangle to texture size the same way
+// as SDL_BlitSurface() does
+static void clipBlitSource(const SDL_Surface *surf, SDL_Rect *src, int *x,
+	int *y) {
+
+	if (src->x < 0) {
+		src->w += src->x;
+		*x -= src->x;
+		src->x = 0;
+	}
+
+	if (src->y < 0) {
+		src->h += src->y;
+		*y -= src->y;
+		src->y = 0;
+	}
+
+	src->w = MIN(src->w, surf->w - src->x);
+	src->h = MIN(src->h, surf->h - src->y);
+}
+
+// Same clipping as SDL_BlitSurface() but against arbitrary clip rectangle
+static void clippedBlit(const Texture *tex, unsigned band,
+	const SDL_Rect *srcrect, int x, int y, const SDL_Rect *clip) {
+
+	int dx;
+	SDL_Surface *surf = tex->drawsurf;
+	SDL_Rect src = *srcrect, dst;
+
+	clipBlitSource(surf, &src, &x, &y);
+	dx = clip->x - x;
+
+	if (dx > 0) {
+		src.w -= dx;
+		src.x += dx;
+		x += dx;
+	}
+
+	dx = clip->y - y;
+
+	if (dx > 0) {
+		src.h -= dx;
+		src.y += dx;
+		y += dx;
+	}
+
+	src.w = MIN(src.w, clip->x + clip->w - x);
+	src.h = MIN(src.h, clip->y + clip->h - y);
+
+	if (src.w <= 0 || src.h <= 0) {
+		return;
+	}
+
+	if (tex->blit) {
+		tex->blit((const uint32_t*)((const uint8_t*)surf->pixels +
+			src.y * surf->pitch) + src.x,
+			surf->pitch / sizeof(uint32_t),
+			(uint32_t*)((uint8_t*)drawbuffer->pixels +
+			y * drawbuffer->pitch) + x,
+			drawbuffer->pitch / sizeof(uint32_t), src.w, src.h);
+		return;
+	}
+
+	if (band) {
+		surf = tex->bandsurfs[band - 1];
+	}
+
+	dst.x = x;
+	dst.y = y;
+	dst.w = src.w;
+	dst.h = src.h;
+	SDL_LowerBlit(surf, &src, drawbuffer, &dst);
+}
+
+static void clippedFill(const SDL_Rect *rect, uint32_t color,
+	const SDL_Rect *clip) {
+
+	SDL_Rect tmp;
+
+	if (SDL_IntersectRect(rect, clip, &tmp)) {
+		SDL_FillRect(drawbuffer, &tmp, color);
+	}
+}
+
+// Write horizontal or vertical run of pixels directly into drawbuffer
+static void drawSpan(int x, int y, int len, int vertical, uint32_t color,
+	const SDL_Rect *clip) {
+
+	int end;
+	uint32_t *ptr;
+	unsigned step;
+
+	if (vertical) {
+		if (x < clip->x || x >= clip->x + clip->w) {
+			return;
+		}
+
+		end = MIN(y + len, clip->y + clip->h);
+		y = MAX(y, clip->y);
+		len = end - y;
+		step = drawbuffer->pitch / sizeof(uint32_t);
+	} else {
+		if (y < clip->y || y >= clip->y + clip->h) {
+			return;
+		}
+
+		end = MIN(x + len, clip->x + clip->w);
+		x = MAX(x, clip->x);
+		len = end - x;
+		step = 1;
+	}
+
+	ptr = (uint32_t*)((uint8_t*)drawbuffer->pixels + y * drawbuffer->pitch);
+
+	for (ptr += x; len > 0; len--, ptr += step) {
+		*ptr = color;
+	}
+}
+
+// Split the line into (len / steps) long pixel runs along the major axis
+// and write them straight into drawbuffer. The pixel buffer of a software
+// surface is always accessible so no locking is needed.
+static void rasterizeLine(int x1, int y1, int x2, int y2, uint32_t color,
+	const SDL_Rect *clip) {
+
+	int x, y, pos, dir, major;
+	unsigned xlen, ylen, steps, len, cur, i;
+	SDL_Rect bounds;
+
+	bounds.x = MIN(x1, x2);
+	bounds.y = MIN(y1, y2);
+	bounds.w = MAX(x1, x2) - bounds.x + 1;
+	bounds.h = MAX(y1, y2) - bounds.y + 1;
+
+	if (!SDL_HasIntersection(&bounds, clip)) {
+		return;
+	}
+
+	xlen = bounds.w;
+	ylen = bounds.h;
+	major = ylen >= xlen;
+
+	if (!major) {
+		steps = ylen;
+		len = xlen;
+		x = x1 < x2 ? x1 : x2;
+		y = x1 < x2 ? y1 : y2;
+		dir = y1 < y2 ? 1 : -1;
+		dir = x1 < x2 ? dir : -dir;
+	} else {
+		steps = xlen;
+		len = ylen;
+		x = y1 < y2 ? x1 : x2;
+		y = y1 < y2 ? y1 : y2;
+		dir = x1 < x2 ? 1 : -1;
+		dir = y1 < y2 ? dir : -dir;
+	}
+
+	for (i = 0, pos = 0; i < steps; i++) {
+		cur = (len * (i + 1)) / steps;
+
+		if (major) {
+			drawSpan(x, y + pos, cur - pos, 1, color, clip);
+			x += dir;
+		} else {
+			drawSpan(x + pos, y, cur - pos, 0, color, clip);
+			y += dir;
+		}
+
+		pos = cur;
+	}
+}
+
+static void bandRect(unsigned band, SDL_Rect *rect) {
+	rect->x = 0;
+	rect->y = (band * SCREEN_HEIGHT) / render_threads;
+	rect->w = SCREEN_WIDTH;
+	rect->h = ((band + 1) * SCREEN_HEIGHT) / render_threads - rect->y;
+}
+
+// Replay recorded draw commands, touching only pixels inside given area.
+// The area must lie within the render band.
+static void replayArea(const SDL_Rect *area, unsigned band) {
+	size_t i;
+	const DrawCommand *cmd;
+	SDL_Rect clip = *area;
+
+	for (i = 0, cmd = draw_commands; i < command_count; i++, cmd++) {
+		switch (cmd->type) {
+		case DRAW_TEXTURE:
+			clippedBlit(textures + cmd->texture, band, &cmd->src,
+				cmd->dst.x, cmd->dst.y, &clip);
+			break;
+
+		case DRAW_LINE:
+			rasterizeLine(cmd->src.x, cmd->src.y, cmd->dst.x,
+				cmd->dst.y, cmd->color, &clip);
+			break;
+
+		case DRAW_FILL:
+			clippedFill(&cmd->dst, cmd->color, &clip);
+			break;
+
+		case DRAW_CLIP:
+			if (!SDL_IntersectRect(&cmd->dst, area, &clip)) {
+				clip.w = clip.h = 0;
+			}
+
+			break;
+
+		case DRAW_UNCLIP:
+			clip = *area;
+			break;
+		}
+	}
+}
+
+static void regionRect(unsigned col, unsigned row, SDL_Rect *rect) {
+	rect->x = col * REGION_WIDTH;
+	rect->y = row * REGION_HEIGHT;
+	rect->w = REGION_WIDTH;
+	rect->h = REGION_HEIGHT;
+}
+
+// Find the next horizontal run of dirty regions in given row
+static int nextDirtySpan(unsigned row, unsigned *col, SDL_Rect *rect) {
+	unsigned start;
+	const char *dirty = dirty_regions + row * REGION_COLS;
+
+	for (; *col < REGION_COLS && !dirty[*col]; (*col)++);
+
+	if (*col >= REGION_COLS) {
+		return 0;
+	}
+
+	for (start = *col; *col < REGION_COLS && dirty[*col]; (*col)++);
+
+	regionRect(start, row, rect);
+	rect->w = (*col - start) * REGION_WIDTH;
+	return 1;
+}
+
+static void renderBand(unsigned band) {
+	unsigned row, col;
+	SDL_Rect bandclip, span, area;
+
+	bandRect(band, &bandclip);
+
+	if (!retained_mode || full_redraw) {
+		replayArea(&bandclip, band);
+		return;
+	}
+
+	for (row = 0; row < REGION_ROWS; row++) {
+		for (col = 0; nextDirtySpan(row, &col, &span);) {
+			if (SDL_IntersectRect(&span, &bandclip, &area)) {
+				replayArea(&area, band);
+			}
+		}
+	}
+}
+
+static void hashData(uint64_t *hash, const void *data, size_t size) {
+	size_t i;
+	const uint8_t *ptr = (const uint8_t*)data;
+
+	for (i = 0; i < size; i++) {
+		*hash = (*hash ^ ptr[i]) * HASH_PRIME;
+	}
+}
+
+// Mix pending draw commands into the hashes of screen regions they touch
+static void hashCommands(void) {
+	size_t i;
+	unsigned row, col;
+	int x, y;
+	const DrawCommand *cmd;
+	const Texture *tex;
+	uint64_t *hash;
+	const SDL_Rect screen = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+	SDL_Rect clip = screen, bounds, src;
+
+	for (i = 0, cmd = draw_commands; i < command_count; i++, cmd++) {
+		switch (cmd->type) {
+		case DRAW_TEXTURE:
+			tex = textures + cmd->texture;
+			src = cmd->src;
+			x = cmd->dst.x;
+			y = cmd->dst.y;
+			clipBlitSource(tex->drawsurf, &src, &x, &y);
+			bounds.x = x;
+			bounds.y = y;
+			bounds.w = src.w;
+			bounds.h = src.h;
+			break;
+
+		case DRAW_LINE:
+			bounds.x = MIN(cmd->src.x, cmd->dst.x);
+			bounds.y = MIN(cmd->src.y, cmd->dst.y);
+			bounds.w = MAX(cmd->src.x, cmd->dst.x) - bounds.x + 1;
+			bounds.h = MAX(cmd->src.y, cmd->dst.y) - bounds.y + 1;
+			break;
+
+		case DRAW_FILL:
+			bounds = cmd->dst;
+			break;
+
+		// New clip region replaces the old one, same as in replay
+		case DRAW_CLIP:
+			if (!SDL_IntersectRect(&cmd->dst, &screen, &clip)) {
+				clip.w = clip.h = 0;
+			}
+
+			continue;
+
+		case DRAW_UNCLIP:
+			clip = screen;
+			continue;
+
+		default:
+			continue;
+		}
+
+		if (!SDL_IntersectRect(&bounds, &clip, &bounds)) {
+			continue;
+		}
+
+		for (row = bounds.y / REGION_HEIGHT;
+			row <= (unsigned)(bounds.y + bounds.h - 1) / REGION_HEIGHT;
+			row++) {
+			for (col = bounds.x / REGION_WIDTH;
+				col <= (unsigned)(bounds.x + bounds.w - 1) /
+				REGION_WIDTH; col++) {
+				hash = region_hashes + row * REGION_COLS + col;
+				hashData(hash, cmd, sizeof(DrawCommand));
+				hashData(hash, &clip, sizeof(clip));
+
+				if (cmd->type == DRAW_TEXTURE) {
+					hashData(hash, &tex->serial,
+						sizeof(tex->serial));
+				}
+			}
+		}
+	}
+}
+
+// Compare region hashes with the previous frame and start a new frame
+static unsigned updateDirtyRegions(void) {
+	unsigned i, ret = 0;
+
+	for (i = 0; i < REGION_COUNT; i++) {
+		dirty_regions[i] = full_redraw ||
+			region_hashes[i] != prev_region_hashes[i];
+		ret += dirty_regions[i];
+		prev_region_hashes[i] = region_hashes[i];
+		region_hashes[i] = HASH_SEED;
+	}
+
+	// Replaying many small areas is slower than one big one
+	if (2 * ret > REGION_COUNT) {
+		full_redraw = 1;
+	}
+
+	return ret;
+}
+
+static int renderWorker(void *arg) {
+	unsigned band = (unsigned)(uintptr_t)arg, generation = 0;
+
+	SDL_LockMutex(render_mutex);
+
+	while (1) {
+		while (!render_quit && generation == render_generation) {
+			SDL_CondWait(render_start, render_mutex);
+		}
+
+		if (render_quit) {
+			break;
+		}
+
+		generation = render_generation;
+		SDL_UnlockMutex(render_mutex);
+		renderBand(band);
+		SDL_LockMutex(render_mutex);
+
+		if (!--render_pending) {
+			SDL_CondSignal(render_done);
+		}
+	}
+
+	SDL_UnlockMutex(render_mutex);
+	return 0;
+}
+
+static void initRenderThreads(void) {
+	unsigned i, count = SDL_GetCPUCount();
+
+	count = MIN(count, MAX_RENDER_THREADS);
+
+	if (count < 2) {
+		return;
+	}
+
+	render_mutex = SDL_CreateMutex();
+	render_start = SDL_CreateCond();
+	render_done = SDL_CreateCond();
+
+	if (!render_mutex || !render_start || !render_done) {
+		throw std::runtime_error("Cannot initialize render threads");
+	}
+
+	// Bands get assigned to workers by index so render_threads must be
+	// final before the first worker starts
+	render_threads = count;
+
+	for (i = 1; i < count; i++) {
+		render_workers[i] = SDL_CreateThread(renderWorker, "render",
+			(void*)(uintptr_t)i);
+
+		if (!render_workers[i]) {
+			throw std::runtime_error("Cannot start render thread");
+		}
+	}
+}
+
+static void shutdownRenderThreads(void) {
+	unsigned i;
+
+	if (render_mutex) {
+		SDL_LockMutex(render_mutex);
+		render_quit = 1;
+		SDL_CondBroadcast(render_start);
+		SDL_UnlockMutex(render_mutex);
+	}
+
+	for (i = 1; i < render_threads; i++) {
+		if (render_workers[i]) {
+			SDL_WaitThread(render_workers[i], NULL);
+			render_workers[i] = NULL;
+		}
+	}
+
+	if (render_done) {
+		SDL_DestroyCond(render_done);
+	}
+
+	if (render_start) {
+		SDL_DestroyCond(render_start);
+	}
+
+	if (render_mutex) {
+		SDL_DestroyMutex(render_mutex);
+	}
+
+	render_done = render_start = NULL;
+	render_mutex = NULL;
+}
+
+// Rasterize all pending draw commands into drawbuffer. Each render thread
+// handles one horizontal band of the screen. In retained mode, the final
+// flush of a frame skips screen regions which did not change.
+static void flushDrawCommands(int endframe = 0) {
+	size_t i;
+
+	if (retained_mode) {
+		hashCommands();
+
+		if (endframe) {
+			updateDirtyRegions();
+		} else {
+			// Texture is about to change, the drawbuffer contents
+			// can no longer be trusted
+			full_redraw = 1;
+		}
+	}
+
+	if (!command_count) {
+		return;
+	}
+
+	for (i = 0; i < command_count; i++) {
+		if (draw_commands[i].type == DRAW_TEXTURE) {
+			prepareBandSurfaces(textures + draw_commands[i].texture);
+		}
+	}
+
+	if (render_threads > 1) {
+		SDL_LockMutex(render_mutex);
+		render_generation++;
+		render_pending = render_threads - 1;
+		SDL_CondBroadcast(render_start);
+		SDL_UnlockMutex(render_mutex);
+	}
+
+	renderBand(0);
+
+	if (render_threads > 1) {
+		SDL_LockMutex(render_mutex);
+
+		while (render_pending) {
+			SDL_CondWait(render_done, render_mutex);
+		}
+
+		SDL_UnlockMutex(render_mutex);
+	}
+
+	command_count = 0;
+
+	// Keep clipping active for the rest of the frame
+	if (command_clip_active) {
+		DrawCommand cmd = {DRAW_CLIP, 0, 0, {0, 0, 0, 0},
+			command_clip};
+
+		appendCommand(cmd);
+	}
+}
+
+#ifdef HAVE_X86_INTRINSICS
+// Replicate each pixel of one screen row scale times
+__attribute__((target("sse2")))
+static void replicateRowSSE2(const uint32_t *src, uint32_t *dst,
+	unsigned scale) {
+
+	unsigned i, j;
+	__m128i pix, out;
+
+	switch (scale) {
+	case 2:
+		for (i = 0; i < SCREEN_WIDTH; i += 4, dst += 8) {
+			pix = _mm_loadu_si128((const __m128i*)(src + i));
+			_mm_storeu_si128((__m128i*)dst,
+				_mm_unpacklo_epi32(pix, pix));
+			_mm_storeu_si128((__m128i*)(dst + 4),
+				_mm_unpackhi_epi32(pix, pix));
+		}
+
+		break;
+
+	case 3:
+		for (i = 0; i < SCREEN_WIDTH; i += 4, dst += 12) {
+			pix = _mm_loadu_si128((const __m128i*)(src + i));
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(1, 0, 0, 0));
+			_mm_storeu_si128((__m128i*)dst, out);
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(2, 2, 1, 1));
+			_mm_storeu_si128((__m128i*)(dst + 4), out);
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(3, 3, 3, 2));
+			_mm_storeu_si128((__m128i*)(dst + 8), out);
+		}
+
+		break;
+
+	case 4:
+		for (i = 0; i < SCREEN_WIDTH; i += 4, dst += 16) {
+			pix = _mm_loadu_si128((const __m128i*)(src + i));
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(0, 0, 0, 0));
+			_mm_storeu_si128((__m128i*)dst, out);
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(1, 1, 1, 1));
+			_mm_storeu_si128((__m128i*)(dst + 4), out);
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(2, 2, 2, 2));
+			_mm_storeu_si128((__m128i*)(dst + 8), out);
+			out = _mm_shuffle_epi32(pix, _MM_SHUFFLE(3, 3, 3, 3));
+			_mm_storeu_si128((__m128i*)(dst + 12), out);
+		}
+
+		break;
+
+	default:
+		// Whole vectors of one pixel, then the remainder
+		for (i = 0; i < SCREEN_WIDTH; i++) {
+			pix = _mm_set1_epi32(src[i]);
+
+			for (j = 0; j + 4 <= scale; j += 4, dst += 4) {
+				_mm_storeu_si128((__m128i*)dst, pix);
+			}
+
+			for (; j < scale; j++) {
+				*dst++ = src[i];
+			}
+		}
+
+		break;
+	}
+}
+#endif
+
+// Nearest neighbour upscale of the whole screen by integer factor
+static void scaleFrame(const uint32_t *src, uint8_t *dst, int pitch,
+	unsigned scale) {
+
+	unsigned x, y, i;
+	uint32_t *row;
+
+	for (y = 0; y < SCREEN_HEIGHT; y++, src += SCREEN_WIDTH) {
+		row = (uint32_t*)dst;
+
+#ifdef HAVE_X86_INTRINSICS
+		if (has_sse2) {
+			replicateRowSSE2(src, row, scale);
+		} else
+#endif
+		for (x = 0; x < SCREEN_WIDTH; x++) {
+			for (i = 0; i < scale; i++) {
+				*row++ = src[x];
+			}
+		}
+
+		for (i = 1; i < scale; i++) {
+			memcpy(dst + i * pitch, dst,
+				SCREEN_WIDTH * scale * sizeof(uint32_t));
+		}
+
+		dst += scale * pitch;
+	}
+}
+
+static int presentWorker(void *arg) {
+	SDL_LockMutex(present_mutex);
+
+	while (1) {
+		while (!present_quit && !present_busy) {
+			SDL_CondWait(present_start, present_mutex);
+		}
+
+		if (present_quit) {
+			break;
+		}
+
+		SDL_UnlockMutex(present_mutex);
+		scaleFrame(present_buffer, (uint8_t*)present_pixels,
+			present_pitch, present_scale);
+		SDL_LockMutex(present_mutex);
+		present_busy = 0;
+		SDL_CondSignal(present_done);
+	}
+
+	SDL_UnlockMutex(present_mutex);
+	return 0;
+}
+
+// Wait until the previous frame is fully upscaled
+static void finishPresent(void) {
+	if (!present_pixels) {
+		return;
+	}
+
+	SDL_LockMutex(present_mutex);
+
+	while (present_busy) {
+		SDL_CondWait(present_done, present_mutex);
+	}
+
+	SDL_UnlockMutex(present_mutex);
+	SDL_UnlockTexture(scaledbuffer);
+	present_pixels = NULL;
+}
+
+static void initPresenter(void) {
+	SDL_RendererInfo info;
+
+	if (SDL_GetRendererInfo(renderer, &info) ||
+		!(info.flags & SDL_RENDERER_SOFTWARE)) {
+		return;
+	}
+
+	present_buffer = new uint32_t[SCREEN_WIDTH * SCREEN_HEIGHT];
+	present_mutex = SDL_CreateMutex();
+	present_start = SDL_CreateCond();
+	present_done = SDL_CreateCond();
+
+	if (!present_mutex || !present_start || !present_done) {
+		throw std::runtime_error("Cannot initialize screen presenter");
+	}
+
+	present_worker = SDL_CreateThread(presentWorker, "present", NULL);
+
+	if (!present_worker) {
+		throw std::runtime_error("Cannot start screen presenter");
+	}
+
+	software_renderer = 1;
+}
+
+static void shutdownPresenter(void) {
+	finishPresent();
+
+	if (present_worker) {
+		SDL_LockMutex(present_mutex);
+		present_quit = 1;
+		SDL_CondSignal(present_start);
+		SDL_UnlockMutex(present_mutex);
+		SDL_WaitThread(present_worker, NULL);
+		present_worker = NULL;
+	}
+
+	if (present_done) {
+		SDL_DestroyCond(present_done);
+	}
+
+	if (present_start) {
+		SDL_DestroyCond(present_start);
+	}
+
+	if (present_mutex) {
+		SDL_DestroyMutex(present_mutex);
+	}
+
+	if (scaledbuffer) {
+		SDL_DestroyTexture(scaledbuffer);
+	}
+
+	delete[] present_buffer;
+	present_buffer = NULL;
+	scaledbuffer = NULL;
+	present_ready = 0;
+	present_done = present_start = NULL;
+	present_mutex = NULL;
+	present_scale = 1;
+	software_renderer = 0;
+}
+
+// The software renderer is slow at scaling the frame to large windows.
+// Upscale the frame by the largest integer factor that fits into the window
+// ourselves and let the renderer handle only the remaining fraction.
+static void updatePresentScale(void) {
+	int width, height;
+	unsigned scale = 1;
+
+	if (!software_renderer) {
+		return;
+	}
+
+	if (!SDL_GetRendererOutputSize(renderer, &width, &height)) {
+		scale = MIN(width / SCREEN_WIDTH, height / SCREEN_HEIGHT);
+		scale = MAX(scale, 1);
+	}
+
+	if (scale == present_scale) {
+		return;
+	}
+
+	finishPresent();
+
+	if (scaledbuffer) {
+		SDL_DestroyTexture(scaledbuffer);
+		scaledbuffer = NULL;
+	}
+
+	present_ready = 0;
+
+	// The other buffer was not updated while the scale was different
+	full_redraw = 1;
+	present_scale = 1;
+
+	if (scale < 2) {
+		return;
+	}
+
+	scaledbuffer = SDL_CreateTexture(renderer, drawbuffer->format->format,
+		SDL_TEXTUREACCESS_STREAMING, scale * SCREEN_WIDTH,
+		scale * SCREEN_HEIGHT);
+
+	if (scaledbuffer) {
+		present_scale = scale;
+		present_ready = 0;
+	}
+}
+
+// Show the previously upscaled frame and start upscaling the current one
+// in the background while the next frame is being drawn
+static void presentScaled(void) {
+	int y;
+	uint8_t *src = (uint8_t*)drawbuffer->pixels;
+
+	finishPresent();
+
+	if (present_ready) {
+		redrawScreen();
+	}
+
+	for (y = 0; y < SCREEN_HEIGHT; y++, src += drawbuffer->pitch) {
+		memcpy(present_buffer + y * SCREEN_WIDTH, src,
+			SCREEN_WIDTH * sizeof(uint32_t));
+	}
+
+	if (SDL_LockTexture(scaledbuffer, NULL, &present_pixels,
+		&present_pitch)) {
+		present_pixels = NULL;
+		return;
+	}
+
+	SDL_LockMutex(present_mutex);
+	present_busy = 1;
+	present_ready = 1;
+	SDL_CondSignal(present_start);
+	SDL_UnlockMutex(present_mutex);
+}
+
+void initScreen(int headless) {
 	unsigned flags = SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN;
 	uint8_t *ptr;
 
+	if (headless) {
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+		flags = SDL_WINDOW_HIDDEN;
+		headless_screen = 1;
+	}
+
 	SDL_Init(SDL_INIT_VIDEO);
 
 	if (SDL_CreateWindowAndRenderer(SCREEN_WIDTH, SCREEN_HEIGHT, flags,
@@ -88,16 +1052,32 @@ void initScreen(void) {
 
 	drawbuffer = SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32,
 		rmask, gmask, bmask, 0);
+	texture_format = SDL_MasksToPixelFormatEnum(32, rmask, gmask, bmask,
+		amask);
+	initBlitFunctions(amask);
+	has_sse2 = SDL_HasSSE2();
 
 	if (!drawbuffer) {
 		throw std::runtime_error("Cannot create draw buffer");
 	}
+
+	command_max = 1024;
+	draw_commands = new DrawCommand[command_max];
+	initRenderThreads();
+	initPresenter();
+	initCapture(drawbuffer->format);
 }
 
 void shutdownScreen(void) {
 	size_t i;
 
+	shutdownCapture();
+	shutdownPresenter();
+	shutdownRenderThreads();
+
 	for (i = 0; i < texture_count; i++) {
+		freeBandSurfaces(textures + i);
+
 		if (textures[i].drawsurf) {
 			SDL_FreeSurface(textures[i].drawsurf);
 		}
@@ -107,6 +1087,12 @@ void shutdownScreen(void) {
 		}
 	}
 
+	delete[] textures;
+	delete[] draw_commands;
+	textures = NULL;
+	draw_commands = NULL;
+	texture_count = texture_max = command_count = command_max = 0;
+
 	if (drawbuffer) {
 		SDL_FreeSurface(drawbuffer);
 	}
@@ -127,46 +1113,101 @@ void shutdownScreen(void) {
 }
 
 void redrawScreen(void) {
+	finishPresent();
 	SDL_RenderClear(renderer);
-	SDL_RenderCopy(renderer, framebuffer, NULL, NULL);
+	SDL_RenderCopy(renderer, present_ready ? scaledbuffer : framebuffer,
+		NULL, NULL);
 	SDL_RenderPresent(renderer);
 	SDL_UpdateWindowSurface(window);
 }
 
-void updateScreen(void) {
+// Copy part of drawbuffer into framebuffer
+static int uploadRect(SDL_Rect *rect) {
 	int pitch, access, width, height;
 	uint32_t format;
 	void *pixels;
 	SDL_Surface *target;
-	SDL_Rect dstpos = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+	SDL_Rect dstpos = {0, 0, rect->w, rect->h};
 
-	if (SDL_LockTexture(framebuffer, NULL, &pixels, &pitch)) {
-		return;
+	if (SDL_LockTexture(framebuffer, rect, &pixels, &pitch)) {
+		return 0;
 	}
 
 	if (SDL_QueryTexture(framebuffer, &format, &access, &width, &height)) {
 		SDL_UnlockTexture(framebuffer);
-		return;
+		return 0;
 	}
 
-	target = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height,
+	target = SDL_CreateRGBSurfaceWithFormatFrom(pixels, rect->w, rect->h,
 		pitch / width, pitch, format);
 
 	if (!target) {
 		SDL_UnlockTexture(framebuffer);
-		return;
+		return 0;
 	}
 
-	SDL_BlitSurface(drawbuffer, NULL, target, &dstpos);
+	SDL_BlitSurface(drawbuffer, rect, target, &dstpos);
 	SDL_FreeSurface(target);
 	SDL_UnlockTexture(framebuffer);
-	redrawScreen();
+	return 1;
+}
+
+void updateScreen(void) {
+	unsigned row, col;
+	int ret = 1;
+	SDL_Rect rect = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+	PROFILE_SCOPE("updateScreen");
+
+	flushDrawCommands(1);
+	captureFrame(drawbuffer);
+
+	// Nobody is watching, the draw buffer is complete
+	if (headless_screen) {
+		full_redraw = 0;
+		return;
+	}
+
+	updatePresentScale();
+
+	if (scaledbuffer) {
+		presentScaled();
+		full_redraw = 0;
+		return;
+	}
+
+	if (!retained_mode || full_redraw) {
+		ret = uploadRect(&rect);
+	} else {
+		for (row = 0; ret && row < REGION_ROWS; row++) {
+			for (col = 0; ret && nextDirtySpan(row, &col, &rect);) {
+				ret = uploadRect(&rect);
+			}
+		}
+	}
+
+	full_redraw = !ret;
+
+	if (ret) {
+		redrawScreen();
+	}
+}
+
+void setRetainedMode(int enable) {
+	unsigned i;
+
+	for (i = 0; i < REGION_COUNT; i++) {
+		region_hashes[i] = HASH_SEED;
+	}
+
+	retained_mode = enable;
+	full_redraw = 1;
 }
 
 unsigned registerTexture(unsigned width, unsigned height, const uint32_t *data) {
 	SDL_Surface *surf;
 	uint8_t *pixptr;
 	unsigned i;
+	PROFILE_SCOPE("registerTexture");
 
 	if (texture_count >= texture_max) {
 		resizeTextureRegistry();
@@ -194,6 +1235,38 @@ unsigned registerTexture(unsigned width, unsigned height, const uint32_t *data)
 
 	textures[texture_count].palsurf = NULL;
 	textures[texture_count].drawsurf = surf;
+	textures[texture_count].blit = selectBlitFunction(surf);
+	textures[texture_count].serial = texture_serial++;
+	return texture_count++;
+}
+
+unsigned snapshotScreen(int x, int y, unsigned width, unsigned height) {
+	SDL_Surface *surf;
+	SDL_Rect rect = {x, y, (int)width, (int)height};
+	PROFILE_SCOPE("snapshotScreen");
+
+	if (texture_count >= texture_max) {
+		resizeTextureRegistry();
+	}
+
+	flushDrawCommands();
+	surf = SDL_CreateRGBSurface(0, width, height, 32, rmask, gmask, bmask,
+		amask);
+
+	if (!surf) {
+		throw std::runtime_error("Cannot allocate new SDL surface");
+	}
+
+	// Draw buffer has no alpha channel, the copy will be fully opaque
+	if (SDL_BlitSurface(drawbuffer, &rect, surf, NULL)) {
+		SDL_FreeSurface(surf);
+		throw std::runtime_error("Cannot copy screen contents");
+	}
+
+	textures[texture_count].palsurf = NULL;
+	textures[texture_count].drawsurf = surf;
+	textures[texture_count].blit = selectBlitFunction(surf);
+	textures[texture_count].serial = texture_serial++;
 	return texture_count++;
 }
 
@@ -203,6 +1276,7 @@ unsigned registerTexture(unsigned width, unsigned height, const uint8_t *data,
 	SDL_Surface *surf;
 	uint8_t *pixptr;
 	unsigned i, texid;
+	PROFILE_SCOPE("registerTexture");
 
 	if (texture_count >= texture_max) {
 		resizeTextureRegistry();
@@ -261,6 +1335,7 @@ void setTexturePalette(unsigned id, const uint8_t *palette,
 		throw std::invalid_argument("Texture does not have a palette");
 	}
 
+	flushDrawCommands();
 	surf = textures[id].palsurf;
 
 	for (i = 0; i < colors; i++) {
@@ -275,19 +1350,22 @@ void setTexturePalette(unsigned id, const uint8_t *palette,
 		throw std::runtime_error("Failed to modify texture palette");
 	}
 
-	surf = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGBA32, 0);
+	surf = SDL_ConvertSurfaceFormat(surf, texture_format, 0);
 
 	if (!surf) {
 		throw std::runtime_error("Failed to convert pixel format");
 	}
 
 	SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_BLEND);
+	freeBandSurfaces(textures + id);
 
 	if (textures[id].drawsurf) {
 		SDL_FreeSurface(textures[id].drawsurf);
 	}
 
 	textures[id].drawsurf = surf;
+	textures[id].blit = selectBlitFunction(surf);
+	textures[id].serial = texture_serial++;
 }
 
 void freeTexture(unsigned id) {
@@ -297,6 +1375,9 @@ void freeTexture(unsigned id) {
 		return;
 	}
 
+	flushDrawCommands();
+	freeBandSurfaces(textures + id);
+
 	if (textures[id].drawsurf) {
 		SDL_FreeSurface(textures[id].drawsurf);
 		textures[id].drawsurf = NULL;
@@ -319,98 +1400,86 @@ void freeTexture(unsigned id) {
 }
 
 void drawTexture(unsigned id, int x, int y) {
-	SDL_Rect dst = {x, y, 0, 0};
+	DrawCommand cmd = {DRAW_TEXTURE, id, 0, {0, 0, 0, 0}, {x, y, 0, 0}};
 
 	if (id >= texture_count || !textures[id].drawsurf) {
 		throw std::out_of_range("Invalid texture ID");
 	}
 
-	SDL_BlitSurface(textures[id].drawsurf, NULL, drawbuffer, &dst);
+	cmd.src.w = textures[id].drawsurf->w;
+	cmd.src.h = textures[id].drawsurf->h;
+	appendCommand(cmd);
+	profileCount(PROFILE_DRAW_CALLS, 1);
+	profileCount(PROFILE_BLIT_BYTES, cmd.src.w * cmd.src.h * 4);
 }
 
 void drawTextureTile(unsigned id, int x, int y, int offsx, int offsy,
 	unsigned width, unsigned height) {
-	SDL_Rect src = {offsx, offsy, (int)width, (int)height};
-	SDL_Rect dst = {x, y, SCREEN_WIDTH, SCREEN_HEIGHT};
+	DrawCommand cmd = {DRAW_TEXTURE, id, 0,
+		{offsx, offsy, (int)width, (int)height}, {x, y, 0, 0}};
 
 	if (id >= texture_count || !textures[id].drawsurf) {
 		throw std::out_of_range("Invalid texture ID");
 	}
 
-	SDL_BlitSurface(textures[id].drawsurf, &src, drawbuffer, &dst);
+	appendCommand(cmd);
+	profileCount(PROFILE_DRAW_CALLS, 1);
+	profileCount(PROFILE_BLIT_BYTES, width * height * 4);
 }
 
 void drawLine(int x1, int y1, int x2, int y2, uint8_t r, uint8_t g, uint8_t b) {
-	int x, y, dx = 1, dy = 1;
-	unsigned xlen, ylen, steps, len, cur, i = 0;
-	uint32_t color = SDL_MapRGB(drawbuffer->format, r, g, b);
-	SDL_Rect rect = {x1, y1, 1, 1};
-
-	xlen = (x1 < x2 ? x2 - x1 : x1 - x2) + 1;
-	ylen = (y1 < y2 ? y2 - y1 : y1 - y2) + 1;
-
-	if (xlen > ylen) {
-		steps = ylen;
-		len = xlen;
-		x = x1 < x2 ? x1 : x2;
-		y = x1 < x2 ? y1 : y2;
-		dy = y1 < y2 ? 1 : -1;
-		dy = x1 < x2 ? dy : -dy;
-	} else {
-		steps = xlen;
-		len = ylen;
-		x = y1 < y2 ? x1 : x2;
-		y = y1 < y2 ? y1 : y2;
-		dx = x1 < x2 ? 1 : -1;
-		dx = y1 < y2 ? dx : -dx;
-	}
+	DrawCommand cmd = {DRAW_LINE, 0, 0, {x1, y1, 0, 0}, {x2, y2, 0, 0}};
 
-	rect.x = x;
-	rect.y = y;
+	cmd.color = SDL_MapRGB(drawbuffer->format, r, g, b);
+	appendCommand(cmd);
+}
 
-	for (i = 0; i < steps; i++) {
-		cur = (len * (i + 1)) / steps;
+void drawLines(const int *coords, unsigned count, uint8_t r, uint8_t g,
+	uint8_t b) {
+	unsigned i;
+	DrawCommand cmd = {DRAW_LINE, 0, 0, {0, 0, 0, 0}, {0, 0, 0, 0}};
 
-		if (xlen > ylen) {
-			rect.w = dx = x + cur - rect.x;
-		} else {
-			rect.h = dy = y + cur - rect.y;
-		}
+	cmd.color = SDL_MapRGB(drawbuffer->format, r, g, b);
 
-		SDL_FillRect(drawbuffer, &rect, color);
-		rect.x += dx;
-		rect.y += dy;
+	for (i = 0; i < count; i++, coords += 4) {
+		cmd.src.x = coords[0];
+		cmd.src.y = coords[1];
+		cmd.dst.x = coords[2];
+		cmd.dst.y = coords[3];
+		appendCommand(cmd);
 	}
 }
 
 void drawRect(int x, int y, unsigned width, unsigned height, uint8_t r,
 	uint8_t g, uint8_t b, unsigned thickness) {
 
-	Uint32 color = SDL_MapRGB(drawbuffer->format, r, g, b);
-	SDL_Rect rect = {x, y, (int)width, (int)thickness};
+	DrawCommand cmd = {DRAW_FILL, 0, 0, {0, 0, 0, 0},
+		{x, y, (int)width, (int)thickness}};
 
 	if (width <= 2 * thickness || height <= 2 * thickness) {
 		fillRect(x, y, width, height, r, g, b);
 		return;
 	}
 
-	SDL_FillRect(drawbuffer, &rect, color);
-	rect.y += height - thickness;
-	SDL_FillRect(drawbuffer, &rect, color);
-	rect.y = y + thickness;
-	rect.w = thickness;
-	rect.h = height - 2 * thickness;
-	SDL_FillRect(drawbuffer, &rect, color);
-	rect.x += width - thickness;
-	SDL_FillRect(drawbuffer, &rect, color);
+	cmd.color = SDL_MapRGB(drawbuffer->format, r, g, b);
+	appendCommand(cmd);
+	cmd.dst.y += height - thickness;
+	appendCommand(cmd);
+	cmd.dst.y = y + thickness;
+	cmd.dst.w = thickness;
+	cmd.dst.h = height - 2 * thickness;
+	appendCommand(cmd);
+	cmd.dst.x += width - thickness;
+	appendCommand(cmd);
 }
 
 void fillRect(int x, int y, unsigned width, unsigned height, uint8_t r,
 	uint8_t g, uint8_t b) {
-	SDL_Rect rect = {x, y, (int)width, (int)height};
+	DrawCommand cmd = {DRAW_FILL, 0, 0, {0, 0, 0, 0},
+		{x, y, (int)width, (int)height}};
 
-	SDL_FillRect(drawbuffer, &rect,
-		SDL_MapRGB(drawbuffer->format, r, g, b));
+	cmd.color = SDL_MapRGB(drawbuffer->format, r, g, b);
+	appendCommand(cmd);
 }
 
 void clearScreen(uint8_t r, uint8_t g, uint8_t b) {
@@ -418,11 +1487,17 @@ void clearScreen(uint8_t r, uint8_t g, uint8_t b) {
 }
 
 void setClipRegion(int x, int y, unsigned width, unsigned height) {
-	SDL_Rect rect = {x, y, (int)width, (int)height};
+	DrawCommand cmd = {DRAW_CLIP, 0, 0, {0, 0, 0, 0},
+		{x, y, (int)width, (int)height}};
 
-	SDL_SetClipRect(drawbuffer, &rect);
+	appendCommand(cmd);
+	command_clip = cmd.dst;
+	command_clip_active = 1;
 }
 
 void unsetClipRegion(void) {
-	SDL_SetClipRect(drawbuffer, NULL);
+	DrawCommand cmd = {DRAW_UNCLIP, 0, 0, {0, 0, 0, 0}, {0, 0, 0, 0}};
+
+	appendCommand(cmd);
+	command_clip_active = 0;
 }
@@ -18,6 +18,7 @@
  */
 
 #include <SDL_mutex.h>
+#include <SDL_thread.h>
 #include <stdexcept>
 #include "utils.h"
 
@@ -25,6 +26,10 @@ struct MutexImpl {
 	SDL_mutex *mutex;
 };
 
+struct ThreadImpl {
+	SDL_Thread *thread;
+};
+
 Mutex::Mutex(void) : _mutex(new MutexImpl) {
 	_mutex->mutex = SDL_CreateMutex();
 
@@ -60,3 +65,42 @@ int Mutex::try_lock(void) {
 
 	return !ret;
 }
+
+Thread::Thread(void) : _thread(new ThreadImpl) {
+	_thread->thread = NULL;
+}
+
+Thread::~Thread(void) {
+	join();
+	delete _thread;
+}
+
+void Thread::start(thread_func func, void *arg, const char *name) {
+	if (_thread->thread) {
+		throw std::logic_error("Thread is already running");
+	}
+
+	_thread->thread = SDL_CreateThread(func, name, arg);
+
+	if (!_thread->thread) {
+		throw std::runtime_error("Could not start thread");
+	}
+}
+
+int Thread::join(void) {
+	int ret = 0;
+
+	if (_thread->thread) {
+		SDL_WaitThread(_thread->thread, &ret);
+		_thread->thread = NULL;
+	}
+
+	return ret;
+}
+
+void Thread::detach(void) {
+	if (_thread->thread) {
+		SDL_DetachThread(_thread->thread);
+		_thread->thread = NULL;
+	}
+}
@@ -1120,6 +1120,10 @@ void FleetListView::redrawShipInfo(unsigned curtick) {
 	info->redraw(18, 287 + offset, curtick);
 }
 
+const char *FleetListView::name(void) const {
+	return "FleetListView";
+}
+
 void FleetListView::redraw(unsigned curtick) {
 	clearScreen();
 	_bg->draw(0, 0);
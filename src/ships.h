@@ -130,6 +130,7 @@ public:
 	FleetListView(GameState *game, int activePlayer);
 	~FleetListView(void);
 
+	const char *name(void) const;
 	void redraw(unsigned curtick);
 
 	void open(void);
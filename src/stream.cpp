@@ -22,7 +22,9 @@
 #include <cmath>
 #include <cfloat>
 #include <cassert>
+#include <stdexcept>
 
+#include "system.h"
 #include "stream.h"
 
 #if FLT_RADIX != 2
@@ -640,8 +642,19 @@ bool File::eos() const {
 	return feof(_file);
 }
 
+void File::sync(void) {
+	assert(_file && (_mode & WRITE));
+
+	if (fflush(_file)) {
+		throw std::runtime_error("Cannot write file");
+	}
+
+	sync_file(_file);
+}
+
 MemoryWriteStream::MemoryWriteStream(size_t alloc) :
-	_data(new unsigned char[alloc + 1]), _size(alloc + 1), _pos(0) {
+	_data(new unsigned char[alloc + 1]), _size(alloc + 1), _pos(0),
+	_length(0) {
 
 	memset(_data, 0, _size * sizeof(unsigned char));
 }
@@ -650,23 +663,53 @@ MemoryWriteStream::~MemoryWriteStream(void) {
 	delete[] _data;
 }
 
-size_t MemoryWriteStream::write(const void *buf, size_t size) {
-	if (_pos + size >= _size) {
-		unsigned char *tmp;
-
-		_size = _pos + size > 2 * _size ? _pos + size : 2 * _size;
-		tmp = new unsigned char[_size];
-		memcpy(tmp, _data, _pos);
-		memset(tmp + _pos + size, 0, _size - _pos - size);
-		delete[] _data;
-		_data = tmp;
+void MemoryWriteStream::reserve(size_t size) {
+	unsigned char *tmp;
+
+	if (size < _size) {
+		return;
 	}
 
+	size = size > 2 * _size ? size : 2 * _size;
+	tmp = new unsigned char[size];
+	memcpy(tmp, _data, _length);
+	memset(tmp + _length, 0, size - _length);
+	delete[] _data;
+	_data = tmp;
+	_size = size;
+}
+
+size_t MemoryWriteStream::write(const void *buf, size_t size) {
+	reserve(_pos + size);
 	memcpy(_data + _pos, buf, size);
 	_pos += size;
+	_length = _pos > _length ? _pos : _length;
 	return size;
 }
 
+void MemoryWriteStream::seek(long offset, int whence) {
+	switch (whence) {
+	case SEEK_SET:
+		if (offset >= 0) {
+			_pos = offset;
+		}
+
+		break;
+
+	case SEEK_CUR:
+		if (offset >= 0 || _pos >= (size_t)-offset) {
+			_pos += offset;
+		}
+
+		break;
+
+	case SEEK_END:
+		if (offset >= 0 || _length >= (size_t)-offset) {
+			_pos = _length + offset;
+		}
+	}
+}
+
 BitStream::BitStream(ReadStream &stream) : _stream(stream), _lastByte(0),
 	_bitsLeft(0) {
 
@@ -118,6 +118,14 @@ public:
 	virtual ~WriteStream() { }
 };
 
+class SeekableWriteStream : public WriteStream {
+public:
+	virtual void seek(long offset, int whence) = 0;
+	virtual long pos(void) const = 0;
+
+	~SeekableWriteStream() { }
+};
+
 class File : public SeekableReadStream, public WriteStream {
 public:
 	typedef enum {
@@ -153,12 +161,16 @@ public:
 	inline const char *getName(void) const { return _name; }
 	inline bool isOpen(void) const { return _file; }
 	bool eos() const;
+	// Flush written data all the way to disk
+	void sync(void);
 };
 
-class MemoryWriteStream : public WriteStream {
+class MemoryWriteStream : public SeekableWriteStream {
 private:
 	unsigned char *_data;
-	size_t _size, _pos;
+	size_t _size, _pos, _length;
+
+	void reserve(size_t size);
 
 	// Do not implement
 	MemoryWriteStream(const MemoryWriteStream &src);
@@ -168,8 +180,11 @@ public:
 	~MemoryWriteStream(void);
 
 	size_t write(const void *buf, size_t size);
+	// Seeking past the end fills the gap with zeros on next write
+	void seek(long offset, int whence);
+	long pos(void) const { return _pos; }
 	void *dataPtr(void) const { return _data; }
-	size_t size(void) const { return _pos; }
+	size_t size(void) const { return _length; }
 };
 
 class BitStream {
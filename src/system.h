@@ -20,6 +20,8 @@
 #ifndef SYSTEM_H_
 #define SYSTEM_H_
 
+#include <cstdio>
+
 // Return the name of parent directory
 char *parent_dir(const char *path);
 
@@ -29,6 +31,15 @@ void create_dir(const char *path);
 // Create a whole path
 void create_path(const char *path);
 
+// Flush file contents from OS buffers to disk
+void sync_file(FILE *fp);
+
+// Atomically replace file at destpath with file at srcpath
+void replace_file(const char *srcpath, const char *destpath);
+
+// Number of online CPU cores, at least 1
+unsigned cpu_count(void);
+
 // Join two path segments using the appropriate directory separator
 // Returns newly allocated string
 char *concatPath(const char *basepath, const char *relpath);
@@ -17,11 +17,13 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <cstdio>
 #include <cstring>
 #include <cerrno>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <stdexcept>
@@ -33,6 +35,43 @@ void create_dir(const char *path) {
 	}
 }
 
+void sync_file(FILE *fp) {
+	if (fsync(fileno(fp))) {
+		throw std::runtime_error("Could not flush file to disk");
+	}
+}
+
+void replace_file(const char *srcpath, const char *destpath) {
+	int fd, ret;
+	char *dir;
+
+	if (rename(srcpath, destpath)) {
+		throw std::runtime_error("Could not replace file");
+	}
+
+	// The rename itself is not on disk until the directory is synced
+	dir = parent_dir(destpath);
+	fd = open(dir, O_RDONLY);
+	delete[] dir;
+
+	if (fd < 0) {
+		throw std::runtime_error("Could not open parent directory");
+	}
+
+	ret = fsync(fd);
+	close(fd);
+
+	if (ret) {
+		throw std::runtime_error("Could not flush directory to disk");
+	}
+}
+
+unsigned cpu_count(void) {
+	long ret = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return ret > 0 ? ret : 1;
+}
+
 char *concatPath(const char *basepath, const char *relpath) {
 	size_t baselen, pathlen;
 	char *ret;
@@ -17,13 +17,21 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <cassert>
 #include <cstddef>
 #include <cstring>
 #include <cctype>
 #include "utils.h"
 
-Recyclable *GarbageCollector::_garbage = NULL;
-Mutex GarbageCollector::_garbageMutex;
+std::atomic<Recyclable*> GarbageCollector::_garbage(NULL);
+std::atomic<uint64_t> GarbageCollector::_epoch(1);
+std::atomic<uint64_t> GarbageCollector::_threadEpochs[MAX_GC_THREADS];
+std::atomic<int> GarbageCollector::_flushing(0);
+Recyclable *GarbageCollector::_pending = NULL;
+MemoryPool::PoolBlock *MemoryPool::_freeList[POOL_SIZE_CLASSES] = {NULL};
+MemoryPoolStats MemoryPool::_stats[POOL_SIZE_CLASSES];
+size_t MemoryPool::_largeAllocs = 0;
+Mutex MemoryPool::_poolMutex;
 
 AutoMutex::AutoMutex(Mutex &m) : _mutex(m) {
 	_mutex.lock();
@@ -33,12 +41,136 @@ AutoMutex::~AutoMutex(void) {
 	_mutex.unlock();
 }
 
-Recyclable::Recyclable(void) : _nextGarbage(NULL) {
+void MemoryPool::addSlab(unsigned cls) {
+	unsigned i;
+	size_t size = (cls + 1) * POOL_GRANULARITY;
+	char *slab;
+	PoolBlock *block;
+
+	slab = (char*)::operator new(size * POOL_SLAB_OBJECTS);
+
+	for (i = 0; i < POOL_SLAB_OBJECTS; i++) {
+		block = (PoolBlock*)(slab + i * size);
+		block->next = _freeList[cls];
+		_freeList[cls] = block;
+	}
+
+	_stats[cls].objectSize = size;
+	_stats[cls].slabs++;
+	_stats[cls].free += POOL_SLAB_OBJECTS;
+}
+
+void *MemoryPool::alloc(size_t size) {
+	unsigned cls;
+	PoolBlock *ret;
+
+	if (!size || size > POOL_MAX_SIZE) {
+		ret = (PoolBlock*)::operator new(size);
+		AutoMutex lock(_poolMutex);
+		_largeAllocs++;
+		return ret;
+	}
+
+	cls = (size - 1) / POOL_GRANULARITY;
+	AutoMutex lock(_poolMutex);
+
+	if (!_freeList[cls]) {
+		addSlab(cls);
+	}
+
+	ret = _freeList[cls];
+	_freeList[cls] = ret->next;
+	_stats[cls].used++;
+	_stats[cls].free--;
+	_stats[cls].requestedBytes += size;
+	return ret;
+}
+
+void MemoryPool::free(void *ptr, size_t size) {
+	unsigned cls;
+	PoolBlock *block = (PoolBlock*)ptr;
+
+	if (!ptr) {
+		return;
+	}
+
+	if (!size || size > POOL_MAX_SIZE) {
+		::operator delete(ptr);
+		AutoMutex lock(_poolMutex);
+		_largeAllocs--;
+		return;
+	}
+
+	cls = (size - 1) / POOL_GRANULARITY;
+	AutoMutex lock(_poolMutex);
+	block->next = _freeList[cls];
+	_freeList[cls] = block;
+	_stats[cls].used--;
+	_stats[cls].free++;
+	_stats[cls].requestedBytes -= size;
+}
+
+size_t MemoryPool::getStats(MemoryPoolStats *stats) {
+	unsigned i;
+	AutoMutex lock(_poolMutex);
+
+	for (i = 0; i < POOL_SIZE_CLASSES; i++) {
+		stats[i] = _stats[i];
+		stats[i].objectSize = (i + 1) * POOL_GRANULARITY;
+	}
+
+	return _largeAllocs;
+}
+
+void MemoryPool::printStats(FILE *fw) {
+	unsigned i;
+	size_t large, total, slack;
+	MemoryPoolStats stats[POOL_SIZE_CLASSES];
+
+	large = getStats(stats);
+	fprintf(fw, "Memory pool (%lu large objects outside pool):\n",
+		(unsigned long)large);
+
+	for (i = 0; i < POOL_SIZE_CLASSES; i++) {
+		if (!stats[i].slabs) {
+			continue;
+		}
+
+		total = stats[i].used + stats[i].free;
+		// Bytes wasted by rounding up to size class
+		slack = stats[i].used * stats[i].objectSize -
+			stats[i].requestedBytes;
+		fprintf(fw, "  %3lu B: %lu slabs, %lu/%lu used (%lu%%), "
+			"%lu B slack\n", (unsigned long)stats[i].objectSize,
+			(unsigned long)stats[i].slabs,
+			(unsigned long)stats[i].used, (unsigned long)total,
+			(unsigned long)(100 * stats[i].used / total),
+			(unsigned long)slack);
+	}
+}
+
+static thread_local int gc_thread_slot = -1;
+
+Recyclable::Recyclable(void) : _nextGarbage(NULL), _discardEpoch(0),
+	_externalStorage(0) {
 
 }
 
 Recyclable::~Recyclable(void) {
+	// operator delete would hand foreign memory to MemoryPool
+	assert(!_externalStorage);
+}
 
+void Recyclable::setExternalStorage(int value) {
+	_externalStorage = value ? 1 : 0;
+}
+
+void *Recyclable::operator new(size_t size) {
+	return MemoryPool::alloc(size);
+}
+
+void Recyclable::operator delete(void *ptr, size_t size) {
+	MemoryPool::free(ptr, size);
 }
 
 void Recyclable::discard(void) {
@@ -46,28 +178,107 @@ void Recyclable::discard(void) {
 }
 
 void GarbageCollector::discard(Recyclable *item) {
+	Recyclable *head;
+
 	if (!item) {
 		return;
+	} else if (item->_externalStorage) {
+		throw std::logic_error("Cannot discard object in external storage");
+	}
+
+	// Read the epoch only after the caller has unlinked the item
+	item->_discardEpoch = _epoch.load();
+	head = _garbage.load();
+
+	do {
+		item->_nextGarbage = head;
+	} while (!_garbage.compare_exchange_weak(head, item));
+}
+
+void GarbageCollector::registerThread(void) {
+	unsigned i;
+	uint64_t expected;
+
+	if (gc_thread_slot >= 0) {
+		return;
+	}
+
+	for (i = 0; i < MAX_GC_THREADS; i++) {
+		expected = 0;
+
+		if (_threadEpochs[i].compare_exchange_strong(expected,
+			_epoch.load())) {
+			gc_thread_slot = i;
+			return;
+		}
+	}
+
+	throw std::runtime_error("Too many garbage collector threads");
+}
+
+void GarbageCollector::unregisterThread(void) {
+	if (gc_thread_slot < 0) {
+		return;
 	}
 
-	_garbageMutex.lock();
-	item->_nextGarbage = _garbage;
-	_garbage = item;
-	_garbageMutex.unlock();
+	_threadEpochs[gc_thread_slot].store(0);
+	gc_thread_slot = -1;
+}
+
+void GarbageCollector::quiescent(void) {
+	if (gc_thread_slot >= 0) {
+		_threadEpochs[gc_thread_slot].store(_epoch.load());
+	}
 }
 
 void GarbageCollector::flush(void) {
-	Recyclable *cur, *next;
+	unsigned i;
+	uint64_t safe, tmp;
+	Recyclable *cur, *next, *keep = NULL;
+
+	if (_flushing.exchange(1)) {
+		return;
+	}
+
+	cur = _garbage.exchange(NULL);
 
-	_garbageMutex.lock();
-	cur = _garbage;
-	_garbage = NULL;
-	_garbageMutex.unlock();
+	// Objects discarded before the new epoch started are safe to delete
+	// once all registered threads have reported the new epoch
+	safe = _epoch.fetch_add(1) + 1;
+	quiescent();
+
+	for (i = 0; i < MAX_GC_THREADS; i++) {
+		tmp = _threadEpochs[i].load();
+
+		if (tmp && tmp < safe) {
+			safe = tmp;
+		}
+	}
+
+	// Append pending objects from previous flushes
+	if (cur) {
+		for (next = cur; next->_nextGarbage; next = next->_nextGarbage);
+
+		next->_nextGarbage = _pending;
+	} else {
+		cur = _pending;
+	}
+
+	_pending = NULL;
 
 	for (; cur; cur = next) {
 		next = cur->_nextGarbage;
-		delete cur;
+
+		if (cur->_discardEpoch < safe) {
+			delete cur;
+		} else {
+			cur->_nextGarbage = keep;
+			keep = cur;
+		}
 	}
+
+	_pending = keep;
+	_flushing.store(0);
 }
 
 StringBuffer::StringBuffer(size_t size) : _buf(NULL), _length(0), _size(size) {
@@ -20,6 +20,9 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
 #include <ctime>
 #include <cstdarg>
 #include <stdexcept>
@@ -66,35 +69,131 @@ public:
 	~AutoMutex(void);
 };
 
+typedef int (*thread_func)(void *arg);
+
+class Thread {
+private:
+	struct ThreadImpl *_thread;
+
+	// Do NOT implement
+	Thread(const Thread &other);
+	const Thread &operator=(const Thread &other);
+
+public:
+	Thread(void);
+	// Waits for the thread to finish
+	~Thread(void);
+
+	// Run func(arg) in a new thread, throws exception if the previous
+	// thread has not been joined yet
+	void start(thread_func func, void *arg, const char *name);
+	// Wait for the thread to finish and return its exit code. Returns 0
+	// immediately if no thread is running.
+	int join(void);
+	// Let the thread finish on its own, it cannot be joined afterwards
+	void detach(void);
+};
+
+// Size class pools for small objects
+#define POOL_GRANULARITY 16
+#define POOL_SIZE_CLASSES 16
+#define POOL_MAX_SIZE (POOL_GRANULARITY * POOL_SIZE_CLASSES)
+#define POOL_SLAB_OBJECTS 64
+
+// Maximum number of threads registered with GarbageCollector
+#define MAX_GC_THREADS 32
+
+struct MemoryPoolStats {
+	size_t objectSize, slabs, used, free;
+	// Sum of requested sizes of used objects
+	size_t requestedBytes;
+};
+
+// Thread-safe pool allocator for small objects. Memory is never returned
+// to the global heap, freed objects are reused by later allocations of the
+// same size class. Larger objects fall back to the global heap.
+class MemoryPool {
+private:
+	struct PoolBlock {
+		PoolBlock *next;
+	};
+
+	static PoolBlock *_freeList[POOL_SIZE_CLASSES];
+	static MemoryPoolStats _stats[POOL_SIZE_CLASSES];
+	static size_t _largeAllocs;
+	static Mutex _poolMutex;
+
+	static void addSlab(unsigned cls);
+
+public:
+	static void *alloc(size_t size);
+	// Size must be the same as in the matching alloc() call
+	static void free(void *ptr, size_t size);
+
+	// Fill stats for all POOL_SIZE_CLASSES size classes and return the
+	// number of live objects too large for the pool
+	static size_t getStats(MemoryPoolStats *stats);
+	// Print occupancy and fragmentation of each used size class
+	static void printStats(FILE *fw);
+};
+
 // Base class for objects which need to be deleted while possibly still in use
-// by the rendering thread.
+// by other threads.
 class Recyclable {
 private:
 	Recyclable *_nextGarbage;
+	uint64_t _discardEpoch;
+	// Object was constructed in storage not allocated by operator new
+	int _externalStorage;
 
 public:
 	Recyclable(void);
 	virtual ~Recyclable(void) = 0;
 
+	// Objects in external storage cannot be discarded or deleted. Clear
+	// the flag before calling the destructor explicitly.
+	void setExternalStorage(int value);
+
+	// Allocate all recyclable objects from MemoryPool
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+
 	virtual void discard(void);
 
 	friend class GarbageCollector;
 };
 
 // Helper class for collecting discarded objects which cannot be deleted right
-// away. The current implementation allows multiple threads to discard objects
-// but only one rendering thread may keep referencing them after discarding.
+// away. Discarding is lock-free. Threads which may keep referencing discarded
+// objects must register and periodically report a quiescent point where they
+// hold no such references. An object is deleted only after every registered
+// thread has passed a quiescent point since it was discarded. The thread
+// which calls flush() does not need to register.
 class GarbageCollector {
 private:
-	static Recyclable *_garbage;
-	static Mutex _garbageMutex;
+	static std::atomic<Recyclable*> _garbage;
+	static std::atomic<uint64_t> _epoch;
+	// Last quiescent epoch of each registered thread, 0 marks free slot
+	static std::atomic<uint64_t> _threadEpochs[MAX_GC_THREADS];
+	static std::atomic<int> _flushing;
+	// Discarded objects which may still be in use, owned by flush()
+	static Recyclable *_pending;
 
 public:
 	// Discard object, any thread may call this
 	static void discard(Recyclable *item);
 
-	// Free all discarded objects. Only the rendering thread can call this
-	// after it has stopped using all the stale references.
+	// Register or unregister the calling thread as a reader of
+	// recyclable objects
+	static void registerThread(void);
+	static void unregisterThread(void);
+
+	// The calling thread holds no references to discarded objects
+	static void quiescent(void);
+
+	// Free discarded objects which are no longer in use by any registered
+	// thread. The caller must not hold any stale references. Returns
+	// immediately if another thread is already flushing.
 	static void flush(void);
 };
 
@@ -139,6 +238,15 @@ public:
 	char *copystr(void) const;
 };
 
+template <class C> struct SortKey {
+	int64_t key;
+	C item;
+};
+
+// Stable sort by key in ascending order. Bottom-up merge sort, so there is
+// no recursion and the worst case is O(n log n).
+template <class C> void sortByKey(SortKey<C> *data, size_t length);
+
 template <class C> class BilistNode : public Recyclable {
 private:
 	BilistNode *_prev, *_next;
@@ -162,9 +270,11 @@ public:
 	void insert(C *ptr);
 	void append(C *ptr);
 
-	// Unlink this node from parent list, then put it in the garbage
-	// collector but keep references to _next and _prev in case another
-	// thread is still using this object.
+	// Unlink this node from parent list but keep references to _next and
+	// _prev in case another thread is still using this object. The caller
+	// keeps ownership of the node memory.
+	void detach(void);
+	// Detach this node, then put it in the garbage collector
 	void discard(void);
 
 	BilistNode *prev(void);
@@ -261,7 +371,7 @@ void BilistNode<C>::append(C *ptr) {
 }
 
 template <class C>
-void BilistNode<C>::discard(void) {
+void BilistNode<C>::detach(void) {
 	_discarded = 1;
 
 	if (_prev) {
@@ -271,7 +381,11 @@ void BilistNode<C>::discard(void) {
 	if (_next) {
 		_next->_prev = _prev;
 	}
+}
 
+template <class C>
+void BilistNode<C>::discard(void) {
+	detach();
 	Recyclable::discard();
 }
 
@@ -295,4 +409,44 @@ const BilistNode<C> *BilistNode<C>::next(void) const {
 	return _next;
 }
 
+template <class C>
+void sortByKey(SortKey<C> *data, size_t length) {
+	size_t width, start, mid, end, i, j, k;
+	SortKey<C> *src = data, *dst, *tmp;
+
+	if (length <= 1) {
+		return;
+	}
+
+	dst = tmp = new SortKey<C>[length];
+
+	for (width = 1; width < length; width *= 2) {
+		for (start = 0; start < length; start += 2 * width) {
+			mid = MIN(start + width, length);
+			end = MIN(start + 2 * width, length);
+
+			// Take from the left run on equal keys to stay stable
+			for (i = start, j = mid, k = start; k < end; k++) {
+				if (i < mid && (j >= end ||
+					src[i].key <= src[j].key)) {
+					dst[k] = src[i++];
+				} else {
+					dst[k] = src[j++];
+				}
+			}
+		}
+
+		dst = src;
+		src = src == data ? tmp : data;
+	}
+
+	if (src != data) {
+		for (i = 0; i < length; i++) {
+			data[i] = src[i];
+		}
+	}
+
+	delete[] tmp;
+}
+
 #endif
@@ -17,7 +17,9 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <windows.h>
 #include <direct.h>
+#include <io.h>
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
@@ -32,6 +34,26 @@ void create_dir(const char *path) {
 	}
 }
 
+void sync_file(FILE *fp) {
+	if (_commit(_fileno(fp))) {
+		throw std::runtime_error("Could not flush file to disk");
+	}
+}
+
+void replace_file(const char *srcpath, const char *destpath) {
+	if (!MoveFileExA(srcpath, destpath,
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		throw std::runtime_error("Could not replace file");
+	}
+}
+
+unsigned cpu_count(void) {
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
 char *concatPath(const char *basepath, const char *relpath) {
 	size_t i, baselen, pathlen;
 	char *ret;